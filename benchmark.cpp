@@ -0,0 +1,799 @@
+// Benchmarks for the editor's load/save, picking, selection, undo/redo and rendering paths,
+// run against synthetic levels of increasing size. Results are written as JSON so they can
+// be compared between versions, e.g.
+//   level_designer_bench --max-lines 100000 --output results.json
+// Needs to be run from the directory containing DroidSansMono.ttf, and rendering needs an
+// OpenGL context (it's skipped, with a message, if one can't be created).
+
+#include "level.h"
+#include "levelfile.h"
+#include "segmentbatch.h"
+#include "simplify.h"
+#include "spatialgrid.h"
+#include "utils.h"
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mgo {
+
+// Has access to Level's internals so that edits and dialogs can be driven without events
+class LevelBenchmark {
+public:
+    static void confirmDialog(Level& level)
+    {
+        level.m_isDialogActive = false;
+        level.m_dialogCallback(true, "");
+    }
+    static std::size_t lineCount(const Level& level) { return level.m_lines.size(); }
+    static void selectConnectedLines(Level& level, std::size_t lineIdx)
+    {
+        level.addConnectedLinesToHighlight(lineIdx);
+    }
+    static void clearSelection(Level& level) { level.clearHighlightedLines(); }
+    static void moveLines(Level& level, std::vector<std::size_t> indices, int x, int y)
+    {
+        MoveLinesAction action { std::move(indices), x, y };
+        level.applyAction(action);
+        level.addReplayItem(std::move(action));
+    }
+    static void deleteLines(Level& level, std::vector<std::size_t> indices)
+    {
+        level.deleteLines(std::move(indices));
+    }
+    static std::size_t simplifyLines(Level& level, float tolerance)
+    {
+        return level.simplifyLines(tolerance);
+    }
+    static void convertSelectedLines(Level& level) { level.convertHighlightedLines(); }
+    static void compactLines(Level& level) { level.compactLines(); }
+    static void undo(Level& level) { level.undo(); }
+    static void redo(Level& level) { level.redo(); }
+    static std::size_t historySize(const Level& level) { return level.m_replay.size(); }
+    static void pan(Level& level, float x, float y) { level.m_view.move({ x, y }); }
+};
+
+} // namespace mgo
+
+namespace {
+
+using namespace mgo;
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned windowWidth = 800;
+constexpr unsigned windowHeight = 800;
+constexpr int gridSpacing = 50;
+
+struct Options {
+    std::size_t minLines { 1000 };
+    std::size_t maxLines { 1000000 };
+    double minSeconds { 0.2 };
+    std::vector<std::string> scenarios { "maze", "chains", "moving" };
+    std::string output;
+    std::filesystem::path workDir { std::filesystem::temp_directory_path() };
+};
+
+struct Result {
+    std::string benchmark;
+    std::string scenario;
+    std::size_t lines;
+    std::size_t runs;
+    std::size_t opsPerRun;
+    double minNs;
+    double medianNs;
+    double meanNs;
+};
+
+// Walls on a square lattice, each present with a fixed probability, so that most walls
+// share endpoints and the maze is one large connected structure
+LevelData generateMaze(std::size_t lineCount, std::mt19937& rng)
+{
+    LevelData data;
+    data.lines.reserve(lineCount);
+    const auto side = static_cast<int>(std::ceil(std::sqrt(lineCount / (2 * 0.7)))) + 1;
+    std::bernoulli_distribution wall(0.7);
+    for (int y = 0; y <= side && data.lines.size() < lineCount; ++y) {
+        for (int x = 0; x <= side && data.lines.size() < lineCount; ++x) {
+            const int px = x * gridSpacing;
+            const int py = y * gridSpacing;
+            if (x < side && wall(rng)) {
+                data.lines.push_back({ px, py, px + gridSpacing, py, 255, 0, 0 });
+            }
+            if (y < side && wall(rng) && data.lines.size() < lineCount) {
+                data.lines.push_back({ px, py, px, py + gridSpacing, 255, 0, 0 });
+            }
+        }
+    }
+    return data;
+}
+
+// Long random walks, each a single connected chain of short segments
+LevelData generateChains(std::size_t lineCount, std::mt19937& rng)
+{
+    LevelData data;
+    data.lines.reserve(lineCount);
+    constexpr std::size_t chainLength = 5000;
+    const auto chains = (lineCount + chainLength - 1) / chainLength;
+    const auto extent = static_cast<int>(std::sqrt(static_cast<double>(chains)) * 2000) + 2000;
+    std::uniform_int_distribution<int> start(1000, extent - 1000);
+    std::uniform_int_distribution<int> step(-20, 20);
+    for (std::size_t c = 0; c < chains; ++c) {
+        int x = start(rng);
+        int y = start(rng);
+        for (std::size_t i = 0; i < chainLength && data.lines.size() < lineCount; ++i) {
+            const int nx = std::clamp(x + step(rng), 0, extent);
+            const int ny = std::clamp(y + step(rng), 0, extent);
+            data.lines.push_back({ x, y, nx, ny, 255, 0, 0 });
+            data.lines.back().breakable = (i % 50) == 0;
+            x = nx;
+            y = ny;
+        }
+    }
+    return data;
+}
+
+// Many small moving objects scattered around, plus a boundary so there are static lines
+LevelData generateMovingObjects(std::size_t lineCount, std::mt19937& rng)
+{
+    LevelData data;
+    constexpr unsigned sides = 8;
+    const auto objects = lineCount / sides;
+    const auto extent = static_cast<int>(std::sqrt(static_cast<double>(objects)) * 100) + 200;
+    std::uniform_int_distribution<int> position(100, extent - 100);
+    std::uniform_real_distribution<float> delta(-2.f, 2.f);
+    data.lines = { { 0, 0, extent, 0, 255, 0, 0 },
+                   { extent, 0, extent, extent, 255, 0, 0 },
+                   { extent, extent, 0, extent, 255, 0, 0 },
+                   { 0, extent, 0, 0, 255, 0, 0 } };
+    data.movingObjects.reserve(objects);
+    for (std::size_t i = 0; i < objects; ++i) {
+        const double cx = position(rng);
+        const double cy = position(rng);
+        MovingObject m { delta(rng), 100.f, delta(rng), 100.f, delta(rng), 0.f, {} };
+        m.lines = utils::getRegularPolygon(cx + 30, cy, cx, cy, sides);
+        for (auto& l : m.lines) {
+            l.r = 255;
+            l.g = 172;
+            l.b = 163;
+        }
+        data.movingObjects.push_back(std::move(m));
+    }
+    return data;
+}
+
+LevelData generateLevel(const std::string& scenario, std::size_t lineCount)
+{
+    std::mt19937 rng(static_cast<std::mt19937::result_type>(lineCount));
+    LevelData data;
+    if (scenario == "maze") {
+        data = generateMaze(lineCount, rng);
+    } else if (scenario == "chains") {
+        data = generateChains(lineCount, rng);
+    } else if (scenario == "moving") {
+        data = generateMovingObjects(lineCount, rng);
+    } else {
+        throw std::runtime_error("Unknown scenario " + scenario);
+    }
+    data.description = scenario + " " + std::to_string(lineCount);
+    data.startPosition = StartPosition { 75, 75, 0 };
+    data.exitPosition = std::make_pair(125, 125);
+    for (int i = 0; i < 100; ++i) {
+        data.fuelObjects.emplace_back(25 + i * gridSpacing, 25);
+    }
+    return data;
+}
+
+class Runner {
+public:
+    Runner(const Options& options)
+        : m_options(options)
+    {
+    }
+
+    // Repeats run until the minimum time has been spent (and at least three times), calling
+    // the untimed setup before each repetition. Times are recorded per operation.
+    void measure(
+        const std::string& benchmark,
+        const std::string& scenario,
+        std::size_t lines,
+        std::size_t opsPerRun,
+        const std::function<void()>& run,
+        const std::function<void()>& setup = {})
+    {
+        std::vector<double> samples;
+        double total = 0.0;
+        while (samples.size() < 3 || total < m_options.minSeconds) {
+            if (setup) {
+                setup();
+            }
+            const auto start = Clock::now();
+            run();
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            total += seconds;
+            samples.push_back(seconds * 1e9 / static_cast<double>(std::max<std::size_t>(opsPerRun, 1)));
+        }
+        std::sort(samples.begin(), samples.end());
+        Result r { benchmark,
+                   scenario,
+                   lines,
+                   samples.size(),
+                   opsPerRun,
+                   samples.front(),
+                   samples[samples.size() / 2],
+                   std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size() };
+        std::cerr << scenario << " " << lines << " " << benchmark << ": " << r.medianNs
+                  << " ns/op\n";
+        m_results.push_back(std::move(r));
+    }
+
+    void writeJson(std::ostream& out) const
+    {
+        out << "{\n  \"format\": 1,\n  \"results\": [";
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            const auto& r = m_results[i];
+            out << (i ? ",\n" : "\n") << "    { \"benchmark\": \"" << r.benchmark
+                << "\", \"scenario\": \"" << r.scenario << "\", \"lines\": " << r.lines
+                << ", \"runs\": " << r.runs << ", \"ops_per_run\": " << r.opsPerRun
+                << ", \"min_ns\": " << r.minNs << ", \"median_ns\": " << r.medianNs
+                << ", \"mean_ns\": " << r.meanNs << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    const Options& m_options;
+    std::vector<Result> m_results;
+};
+
+// Points just off randomly chosen lines, so that picking mostly finds something
+std::vector<sf::Vector2f> probePoints(const LevelData& data, std::size_t count)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> jitter(-3.f, 3.f);
+    std::vector<sf::Vector2f> points;
+    points.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const Line* l;
+        if (!data.movingObjects.empty() && i % 2) {
+            const auto& m = data.movingObjects[rng() % data.movingObjects.size()];
+            l = &m.lines[rng() % m.lines.size()];
+        } else {
+            l = &data.lines[rng() % data.lines.size()];
+        }
+        points.push_back({ (static_cast<float>(l->x0) + static_cast<float>(l->x1)) / 2 + jitter(rng),
+                           (static_cast<float>(l->y0) + static_cast<float>(l->y1)) / 2 + jitter(rng) });
+    }
+    return points;
+}
+
+// The target's view is centred on each probe point in turn, so the point is always at the
+// centre pixel
+template <typename Fn>
+void forEachProbe(sf::RenderTarget& target, const std::vector<sf::Vector2f>& points, Fn fn)
+{
+    sf::View view(sf::FloatRect({ 0.f, 0.f }, { static_cast<float>(windowWidth), static_cast<float>(windowHeight) }));
+    for (const auto& p : points) {
+        view.setCenter(p);
+        target.setView(view);
+        fn(windowWidth / 2, windowHeight / 2);
+    }
+}
+
+void renderFrame(Level& level, sf::RenderTexture& target)
+{
+    target.setView(level.getView());
+    target.clear();
+    level.drawGridLines(target);
+    level.draw(target);
+    level.drawObjects(target);
+    target.setView(level.getFixedView());
+    level.drawModes(target);
+    target.display();
+}
+
+void runScenario(
+    Runner& runner,
+    const Options& options,
+    const std::string& scenario,
+    std::size_t lines,
+    sf::RenderTexture* target)
+{
+    const LevelData data = generateLevel(scenario, lines);
+    const auto base = options.workDir / ("level_designer_bench_" + scenario + "_" + std::to_string(lines));
+    const std::string textFile = base.string() + ".lvl";
+    const std::string binaryFile = base.string() + ".lvb";
+    writeLevelFile(textFile, data);
+    writeLevelFile(binaryFile, data);
+
+    std::unique_ptr<Level> level;
+    for (const auto& file : { textFile, binaryFile }) {
+        const std::string suffix = isBinaryLevelFile(file) ? "_binary" : "_text";
+        runner.measure(
+            "load" + suffix,
+            scenario,
+            lines,
+            1,
+            [&] { level->load(file); },
+            [&] {
+                level.reset();
+                level = std::make_unique<Level>(windowWidth, windowHeight);
+            });
+        runner.measure("save" + suffix, scenario, lines, 1, [&] {
+            level->save();
+            LevelBenchmark::confirmDialog(*level);
+            level->waitForBackgroundSave();
+        });
+    }
+
+    if (target) {
+        constexpr std::size_t probes = 10000;
+        const auto points = probePoints(data, probes);
+        runner.measure("line_under_cursor", scenario, lines, probes, [&] {
+            forEachProbe(*target, points, [&](unsigned x, unsigned y) {
+                level->lineUnderCursor(*target, x, y);
+            });
+        });
+        runner.measure("highlight_nearest_line_point", scenario, lines, probes, [&] {
+            forEachProbe(*target, points, [&](unsigned x, unsigned y) {
+                level->highlightNearestLinePoint(*target, x, y);
+            });
+        });
+    }
+
+    const std::size_t lineCount = LevelBenchmark::lineCount(*level);
+    if (lineCount > 0) {
+        std::mt19937 rng(2);
+        runner.measure("select_connected_lines", scenario, lines, 10, [&] {
+            for (int i = 0; i < 10; ++i) {
+                LevelBenchmark::selectConnectedLines(*level, rng() % lineCount);
+                LevelBenchmark::clearSelection(*level);
+            }
+        });
+
+        // Each action moves a different handful of lines, so they aren't coalesced
+        constexpr std::size_t historyLength = 1000;
+        for (std::size_t i = 0; i < historyLength; ++i) {
+            std::vector<std::size_t> indices;
+            for (int j = 0; j < 10; ++j) {
+                indices.push_back(rng() % lineCount);
+            }
+            std::sort(indices.begin(), indices.end());
+            indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+            LevelBenchmark::moveLines(*level, std::move(indices), 10, 0);
+        }
+        const auto history = LevelBenchmark::historySize(*level);
+        auto undoAll = [&] {
+            for (std::size_t i = 0; i < history; ++i) {
+                level->undo();
+            }
+        };
+        auto redoAll = [&] {
+            for (std::size_t i = 0; i < history; ++i) {
+                level->redo();
+            }
+        };
+        runner.measure("undo", scenario, lines, history, undoAll, redoAll);
+        runner.measure("redo", scenario, lines, history, redoAll, undoAll);
+    }
+
+    if (target) {
+        runner.measure("render_default_view", scenario, lines, 1, [&] { renderFrame(*level, *target); });
+        // Back and forth across the view, as when dragging it around
+        int panStep = 0;
+        runner.measure("render_pan", scenario, lines, 1, [&] {
+            LevelBenchmark::pan(*level, (panStep++ / 50) % 2 == 0 ? 8.f : -8.f, 0.f);
+            renderFrame(*level, *target);
+        });
+        // As far out as the editor allows
+        for (int i = 0; i < 100; ++i) {
+            level->zoomOut();
+        }
+        runner.measure("render_zoomed_out", scenario, lines, 1, [&] { renderFrame(*level, *target); });
+    }
+
+    level.reset();
+    std::filesystem::remove(textFile);
+    std::filesystem::remove(binaryFile);
+}
+
+// Compares the batch kernels in use with the scalar functions they stand in for over random
+// segments, including zero-length and axis-aligned ones, coordinates right up to the edges
+// of the SIMD kernels' range, and some beyond it
+void checkSegmentBatchKernels()
+{
+    std::mt19937 rng(3);
+    constexpr int minSimd = SegmentBatch::minSimdCoordinate;
+    constexpr int maxSimd = SegmentBatch::maxSimdCoordinate;
+    // Each coordinate comes from one of a range's intervals, picked at random
+    const std::vector<std::vector<std::pair<int, int>>> ranges {
+        { { -20, 20 } },
+        { { -2500, 2500 } },
+        { { minSimd, maxSimd } },
+        { { minSimd, minSimd + 1000 }, { maxSimd - 1000, maxSimd } }, // differences near 2^31
+        { { minSimd - (1 << 26), maxSimd + (1 << 26) } }, // partly beyond the SIMD range
+    };
+    for (const auto& intervals : ranges) {
+        const auto coord = [&](std::mt19937& r) {
+            const auto [lo, hi] = intervals[r() % intervals.size()];
+            return std::uniform_int_distribution<int>(lo, hi)(r);
+        };
+        const auto span = static_cast<std::uint64_t>(
+            static_cast<std::int64_t>(intervals.back().second) - intervals.front().first);
+        for (int round = 0; round < 1000; ++round) {
+            SegmentBatch batch;
+            std::vector<Line> lines;
+            for (std::size_t i = rng() % 40; i > 0; --i) {
+                Line l { coord(rng), coord(rng), coord(rng), coord(rng) };
+                if (rng() % 5 == 0) {
+                    l.x1 = l.x0;
+                }
+                if (rng() % 5 == 0) {
+                    l.y1 = l.y0;
+                }
+                lines.push_back(l);
+                batch.push_back(l);
+            }
+            std::vector<std::pair<int, int>> shape(2 + rng() % 4);
+            for (auto& [x, y] : shape) {
+                x = coord(rng);
+                y = coord(rng);
+            }
+            std::optional<std::size_t> crossing;
+            for (std::size_t i = 0; i < lines.size() && !crossing.has_value(); ++i) {
+                const Line& l = lines[i];
+                for (std::size_t v = 0; v < shape.size(); ++v) {
+                    const auto [x0, y0] = shape[v];
+                    const auto [x1, y1] = shape[(v + 1) % shape.size()];
+                    if (utils::doLinesIntersect(x0, y0, x1, y1, l.x0, l.y0, l.x1, l.y1)) {
+                        crossing = i;
+                        break;
+                    }
+                }
+            }
+            bool agrees = batch.firstCrossing(shape) == crossing;
+
+            const auto [x, y] = shape.front();
+            const int d = static_cast<int>(rng() % (span / 4 + 5));
+            NearestPoints nearest;
+            batch.closestPoints(x, y, d, nearest);
+            for (std::size_t i = 0; i < lines.size(); ++i) {
+                const Line& l = lines[i];
+                const auto point = utils::closestPointOnLine(l.x0, l.y0, l.x1, l.y1, x, y, d);
+                agrees = agrees && point.has_value() == (nearest.within[i] != 0)
+                    && (!point.has_value()
+                        || (point->first == nearest.x[i] && point->second == nearest.y[i]));
+            }
+            if (!agrees) {
+                throw std::runtime_error(
+                    std::string("Batch geometry (") + SegmentBatch::kernelName()
+                    + ") disagrees with the scalar functions");
+            }
+        }
+    }
+}
+
+// Every batch kernel the processor has must agree exactly with the scalar functions, so
+// each is checked in turn before any timings are taken
+void checkSegmentBatch()
+{
+    const std::string chosen = SegmentBatch::kernelName();
+    for (const char* kernel : { "avx2", "sse4.2", "scalar" }) {
+        if (SegmentBatch::useKernels(kernel)) {
+            checkSegmentBatchKernels();
+        } else {
+            std::cerr << "Batch geometry kernels: " << kernel << " unsupported, not checked\n";
+        }
+    }
+    SegmentBatch::useKernels(chosen);
+    std::cerr << "Batch geometry kernels: " << SegmentBatch::kernelName() << "\n";
+}
+
+std::vector<std::array<int, 4>> sortedCoordinates(const LevelData& data)
+{
+    std::vector<std::array<int, 4>> coordinates;
+    for (const Line& l : data.lines) {
+        coordinates.push_back({ l.x0, l.y0, l.x1, l.y1 });
+    }
+    std::sort(coordinates.begin(), coordinates.end());
+    return coordinates;
+}
+
+// Simplifying a closed loop must leave it a loop of at least three distinct lines, however
+// large the tolerance, rather than a spike there and back or a line of zero length
+void checkSimplification()
+{
+    const std::vector<std::vector<std::pair<int, int>>> loops {
+        { { 0, 0 }, { 10, 0 }, { 5, 8 } },
+        { { 0, 0 }, { 50, 0 }, { 100, 0 }, { 100, 50 }, { 100, 100 }, { 50, 100 }, { 0, 100 } },
+    };
+    for (const auto& loop : loops) {
+        for (const float tolerance : { 0.f, 1.f, 9.5f, 12.f, 60.f, 1000.f }) {
+            std::vector<Line> lines;
+            for (std::size_t i = 0; i < loop.size(); ++i) {
+                const auto [x0, y0] = loop[i];
+                const auto [x1, y1] = loop[(i + 1) % loop.size()];
+                lines.push_back({ x0, y0, x1, y1, 255, 0, 0 });
+            }
+            simplifyLines(lines, tolerance);
+            bool agrees = lines.size() >= 3;
+            for (const Line& l : lines) {
+                agrees = agrees && (l.x0 != l.x1 || l.y0 != l.y1);
+                for (const Line& other : lines) {
+                    agrees = agrees && (&l == &other || l.x0 != other.x1 || l.y0 != other.y1
+                                        || l.x1 != other.x0 || l.y1 != other.y0);
+                }
+            }
+            if (!agrees) {
+                throw std::runtime_error(
+                    "Simplifying a closed loop at tolerance " + std::to_string(tolerance)
+                    + " didn't leave a loop");
+            }
+        }
+    }
+}
+
+// Binary level files have to survive a round trip, and a truncated or corrupted one has to
+// be rejected with an error rather than read out of bounds: every prefix of a file is tried,
+// as is the file with each 32-bit word (so each count field among them) set to huge values
+void checkSpatialGrid()
+{
+    // Queries both walk the rectangle's cells and scan the populated cells, depending on which
+    // is fewer, so compare small and huge rectangles against a plain overlap test
+    constexpr float cellSize = 200.f;
+    std::mt19937 rng { 7 };
+    std::uniform_real_distribution<float> coord { -5000.f, 5000.f };
+    std::uniform_real_distribution<float> extent { 0.f, 600.f };
+    SpatialGrid grid { cellSize };
+    std::vector<std::size_t> results;
+    grid.query(-1e6f, -1e6f, 1e6f, 1e6f, results);
+    if (!results.empty()) {
+        throw std::runtime_error("Querying an empty spatial grid found something");
+    }
+    std::vector<std::array<float, 4>> bounds;
+    for (std::size_t id = 0; id < 50; ++id) {
+        const float x = coord(rng);
+        const float y = coord(rng);
+        bounds.push_back({ x, y, x + extent(rng), y + extent(rng) });
+        grid.insertBounds(id, bounds[id][0], bounds[id][1], bounds[id][2], bounds[id][3]);
+    }
+    const auto cell = [&](float v) { return std::floor(v / cellSize); };
+    for (int q = 0; q < 200; ++q) {
+        const float size = q % 2 ? 1e6f : extent(rng) * 4;
+        const float x = coord(rng) - size / 2;
+        const float y = coord(rng) - size / 2;
+        grid.query(x, y, x + size, y + size, results);
+        std::vector<std::size_t> expected;
+        for (std::size_t id = 0; id < bounds.size(); ++id) {
+            const auto& b = bounds[id];
+            if (cell(b[0]) <= cell(x + size) && cell(b[2]) >= cell(x)
+                && cell(b[1]) <= cell(y + size) && cell(b[3]) >= cell(y)) {
+                expected.push_back(id);
+            }
+        }
+        if (results != expected) {
+            throw std::runtime_error(
+                "Spatial grid query of size " + std::to_string(size) + " found "
+                + std::to_string(results.size()) + " items instead of "
+                + std::to_string(expected.size()));
+        }
+    }
+}
+
+void checkBinaryLevelFiles(const Options& options)
+{
+    std::mt19937 rng(5);
+    LevelData data = generateMovingObjects(64, rng);
+    data.description = "Corrupt";
+    data.fuelObjects = { { 10, 20 }, { 30, 40 } };
+    const std::string bytes = levelBinary(data);
+    const LevelData parsed = parseLevelBinary(bytes);
+    bool agrees = parsed.description == data.description
+        && sortedCoordinates(parsed) == sortedCoordinates(data)
+        && parsed.fuelObjects == data.fuelObjects
+        && parsed.movingObjects.size() == data.movingObjects.size();
+
+    const auto rejects = [](std::string_view corrupt) {
+        try {
+            parseLevelBinary(corrupt);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    for (std::size_t length = 0; length < bytes.size(); ++length) {
+        agrees = agrees && rejects(std::string_view(bytes).substr(0, length));
+    }
+    for (std::size_t offset = 0; offset + 4 <= bytes.size(); offset += 4) {
+        for (const std::uint32_t value : { 0xFFFFFFFEu, 0xFFFFFFFFu, 0x10000000u }) {
+            std::string corrupt = bytes;
+            std::memcpy(corrupt.data() + offset, &value, sizeof(value));
+            try {
+                parseLevelBinary(corrupt);
+            } catch (const std::runtime_error&) {
+            }
+        }
+    }
+
+    // Files are mapped rather than read, so reading past the end would fault
+    const auto file = (options.workDir / "level_designer_check_truncated.lvb").string();
+    {
+        std::string truncated = bytes.substr(0, bytes.size() / 2);
+        const std::uint32_t descriptionLength = 0xFFFFFFFE;
+        std::memcpy(truncated.data() + 8, &descriptionLength, sizeof(descriptionLength));
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out.write(truncated.data(), static_cast<std::streamsize>(truncated.size()));
+    }
+    try {
+        std::vector<ParseError> errors;
+        readLevelFile(file, errors);
+        agrees = false;
+    } catch (const std::runtime_error&) {
+    }
+    std::filesystem::remove(file);
+    if (!agrees) {
+        throw std::runtime_error("Binary level files don't round trip or aren't checked");
+    }
+}
+
+// Compacting after deleting half of a level has to actually drop the deleted lines, and
+// undoing and redoing the deletion (and an earlier move of some of the same lines) has to
+// bring back, and take away again, exactly the lines it should
+void checkCompaction(const Options& options)
+{
+    std::mt19937 rng(4);
+    const auto file = (options.workDir / "level_designer_check_compaction.lvb").string();
+    writeLevelFile(file, generateMaze(20000, rng));
+    Level level(windowWidth, windowHeight);
+    level.load(file);
+    std::filesystem::remove(file);
+
+    const std::size_t lineCount = LevelBenchmark::lineCount(level);
+    const auto original = sortedCoordinates(level.levelData());
+    std::vector<std::size_t> moved;
+    std::vector<std::size_t> deleted;
+    for (std::size_t i = 0; i < lineCount; i += 2) {
+        if (i < 1000) {
+            moved.push_back(i);
+        }
+        deleted.push_back(i);
+    }
+    LevelBenchmark::moveLines(level, moved, 10, 0);
+    const auto afterMove = sortedCoordinates(level.levelData());
+    LevelBenchmark::deleteLines(level, deleted);
+    const auto afterDelete = sortedCoordinates(level.levelData());
+    LevelBenchmark::compactLines(level);
+
+    bool agrees = LevelBenchmark::lineCount(level) == lineCount - deleted.size()
+        && sortedCoordinates(level.levelData()) == afterDelete;
+    LevelBenchmark::undo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == afterMove;
+    LevelBenchmark::undo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == original;
+    LevelBenchmark::redo(level);
+    LevelBenchmark::redo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == afterDelete;
+    LevelBenchmark::compactLines(level);
+    agrees = agrees && LevelBenchmark::lineCount(level) == lineCount - deleted.size();
+    LevelBenchmark::undo(level);
+    LevelBenchmark::undo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == original;
+    if (!agrees) {
+        throw std::runtime_error("Compacting deleted lines lost or kept the wrong lines");
+    }
+
+    // Lines simplified away or converted to a moving object are dropped in the same way
+    LevelBenchmark::redo(level);
+    LevelBenchmark::redo(level);
+    const std::size_t simplified = LevelBenchmark::simplifyLines(level, 1.f);
+    const auto afterSimplify = sortedCoordinates(level.levelData());
+    LevelBenchmark::selectConnectedLines(level, LevelBenchmark::lineCount(level) - 1);
+    LevelBenchmark::convertSelectedLines(level);
+    const auto afterConvert = sortedCoordinates(level.levelData());
+    const std::size_t converted = afterSimplify.size() - afterConvert.size();
+    LevelBenchmark::compactLines(level);
+    agrees = simplified > 0 && converted > 0
+        && LevelBenchmark::lineCount(level) == afterConvert.size();
+    LevelBenchmark::undo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == afterSimplify;
+    LevelBenchmark::undo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == afterDelete;
+    LevelBenchmark::redo(level);
+    LevelBenchmark::redo(level);
+    agrees = agrees && sortedCoordinates(level.levelData()) == afterConvert;
+    if (!agrees) {
+        throw std::runtime_error(
+            "Compacting simplified or converted lines lost or kept the wrong lines");
+    }
+}
+
+void usage()
+{
+    std::cout << "Usage: level_designer_bench [options]\n"
+                 "  --min-lines <n>      smallest level size (default 1000)\n"
+                 "  --max-lines <n>      largest level size (default 1000000)\n"
+                 "  --min-time <s>       minimum time spent on each benchmark (default 0.2)\n"
+                 "  --scenario <name>    maze, chains or moving (default all; repeatable)\n"
+                 "  --output <file>      write JSON here rather than stdout\n\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    try {
+        Options options;
+        bool scenarioGiven = false;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                usage();
+                return 1;
+            }
+            const std::string value = argv[++i];
+            if (arg == "--min-lines") {
+                options.minLines = std::stoul(value);
+            } else if (arg == "--max-lines") {
+                options.maxLines = std::stoul(value);
+            } else if (arg == "--min-time") {
+                options.minSeconds = std::stod(value);
+            } else if (arg == "--scenario") {
+                if (!scenarioGiven) {
+                    options.scenarios.clear();
+                    scenarioGiven = true;
+                }
+                options.scenarios.push_back(value);
+            } else if (arg == "--output") {
+                options.output = value;
+            } else {
+                usage();
+                return 1;
+            }
+        }
+
+        std::unique_ptr<sf::RenderTexture> target = std::make_unique<sf::RenderTexture>();
+        if (!target->resize({ windowWidth, windowHeight })) {
+            std::cerr << "Couldn't create an offscreen render target; skipping picking and "
+                         "rendering benchmarks\n";
+            target.reset();
+        }
+
+        checkSegmentBatch();
+        checkSimplification();
+        checkSpatialGrid();
+        checkCompaction(options);
+        checkBinaryLevelFiles(options);
+        Runner runner(options);
+        for (const auto& scenario : options.scenarios) {
+            for (std::size_t lines = options.minLines; lines <= options.maxLines; lines *= 10) {
+                runScenario(runner, options, scenario, lines, target.get());
+            }
+        }
+        if (options.output.empty()) {
+            runner.writeJson(std::cout);
+        } else {
+            std::ofstream out(options.output, std::ios::trunc);
+            runner.writeJson(out);
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    return 1;
+}
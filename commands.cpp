@@ -0,0 +1,327 @@
+#include "commands.h"
+#include "levelfile.h"
+#include "simplify.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using namespace mgo;
+
+// Each file's output is buffered and printed in order once everything has finished, so
+// the report reads the same however the work was scheduled
+using FileTask = std::function<bool(const std::string& filename, std::ostream& out)>;
+
+int processFiles(const std::vector<std::string>& files, const FileTask& task)
+{
+    std::vector<std::ostringstream> outputs(files.size());
+    std::vector<char> succeeded(files.size(), 0);
+    std::atomic<std::size_t> next { 0 };
+    auto worker = [&] {
+        for (std::size_t i = next++; i < files.size(); i = next++) {
+            try {
+                succeeded[i] = task(files[i], outputs[i]);
+            } catch (const std::exception& e) {
+                outputs[i] << files[i] << ": " << e.what() << "\n";
+            }
+        }
+    };
+    const std::size_t threadCount
+        = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, files.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    int failures = 0;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        std::cout << outputs[i].str();
+        if (!succeeded[i]) {
+            ++failures;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+void reportParseErrors(
+    const std::string& filename,
+    const std::vector<ParseError>& errors,
+    std::ostream& out)
+{
+    for (const auto& e : errors) {
+        out << filename << ":" << e.lineNumber << ": " << e.message << "\n";
+    }
+}
+
+bool isZeroLength(const Line& l)
+{
+    return l.x0 == l.x1 && l.y0 == l.y1;
+}
+
+// Lines are the same whichever way round their endpoints are
+struct LineKeyHash {
+    std::size_t operator()(const std::array<int, 4>& k) const
+    {
+        auto pack = [](int a, int b) {
+            return (std::uint64_t { static_cast<std::uint32_t>(a) } << 32)
+                | static_cast<std::uint32_t>(b);
+        };
+        const std::uint64_t h = pack(k[0], k[1]) ^ (pack(k[2], k[3]) * 0x9e3779b97f4a7c15ull);
+        return std::hash<std::uint64_t> {}(h);
+    }
+};
+
+std::array<int, 4> lineKey(const Line& l)
+{
+    if (std::tie(l.x0, l.y0) <= std::tie(l.x1, l.y1)) {
+        return { l.x0, l.y0, l.x1, l.y1 };
+    }
+    return { l.x1, l.y1, l.x0, l.y0 };
+}
+
+// Removes zero-length lines and repeats of an earlier line, keeping the original order.
+// Returns the number of lines removed.
+std::size_t removeRedundantLines(std::vector<Line>& lines)
+{
+    std::unordered_set<std::array<int, 4>, LineKeyHash> seen;
+    seen.reserve(lines.size());
+    const auto originalSize = lines.size();
+    std::erase_if(lines, [&](const Line& l) {
+        return isZeroLength(l) || !seen.insert(lineKey(l)).second;
+    });
+    return originalSize - lines.size();
+}
+
+bool check(const std::string& filename, std::ostream& out)
+{
+    std::vector<ParseError> errors;
+    LevelData data = readLevelFile(filename, errors);
+    reportParseErrors(filename, errors, out);
+    std::size_t problems = errors.size();
+    auto problem = [&](const std::string& message) {
+        out << filename << ": " << message << "\n";
+        ++problems;
+    };
+    if (!data.startPosition.has_value()) {
+        problem("no start position");
+    }
+    if (!data.exitPosition.has_value()) {
+        problem("no exit position");
+    }
+    const auto zeroLength = std::count_if(data.lines.begin(), data.lines.end(), isZeroLength);
+    if (zeroLength > 0) {
+        problem(std::to_string(zeroLength) + " zero-length line(s)");
+    }
+    auto lines = data.lines;
+    const auto duplicates = removeRedundantLines(lines) - zeroLength;
+    if (duplicates > 0) {
+        problem(std::to_string(duplicates) + " duplicate line(s)");
+    }
+    for (std::size_t i = 0; i < data.movingObjects.size(); ++i) {
+        const auto& m = data.movingObjects[i];
+        if (std::any_of(m.lines.begin(), m.lines.end(), isZeroLength)) {
+            problem("moving object " + std::to_string(i) + " has zero-length line(s)");
+        }
+    }
+    if (problems == 0) {
+        out << filename << ": OK\n";
+    }
+    return problems == 0;
+}
+
+bool stats(const std::string& filename, std::ostream& out)
+{
+    std::vector<ParseError> errors;
+    LevelData data = readLevelFile(filename, errors);
+    reportParseErrors(filename, errors, out);
+    std::size_t breakable = 0;
+    std::size_t movingObjectLines = 0;
+    double totalLength = 0.0;
+    int minX = std::numeric_limits<int>::max();
+    int minY = std::numeric_limits<int>::max();
+    int maxX = std::numeric_limits<int>::lowest();
+    int maxY = std::numeric_limits<int>::lowest();
+    auto addLine = [&](const Line& l) {
+        totalLength += std::hypot(
+            static_cast<double>(l.x1) - static_cast<double>(l.x0),
+            static_cast<double>(l.y1) - static_cast<double>(l.y0));
+        minX = std::min({ minX, l.x0, l.x1 });
+        minY = std::min({ minY, l.y0, l.y1 });
+        maxX = std::max({ maxX, l.x0, l.x1 });
+        maxY = std::max({ maxY, l.y0, l.y1 });
+    };
+    for (const auto& l : data.lines) {
+        addLine(l);
+        if (l.breakable) {
+            ++breakable;
+        }
+    }
+    for (const auto& m : data.movingObjects) {
+        movingObjectLines += m.lines.size();
+        std::for_each(m.lines.begin(), m.lines.end(), addLine);
+    }
+    out << filename << ":\n";
+    out << "  format:         " << (isBinaryLevelFile(filename) ? "binary" : "text") << "\n";
+    out << "  description:    " << data.description << "\n";
+    out << "  lines:          " << data.lines.size() << " (" << breakable << " breakable)\n";
+    out << "  moving objects: " << data.movingObjects.size() << " (" << movingObjectLines
+        << " lines)\n";
+    out << "  fuel:           " << data.fuelObjects.size() << "\n";
+    out << "  start:          " << (data.startPosition.has_value() ? "yes" : "no") << "\n";
+    out << "  exit:           " << (data.exitPosition.has_value() ? "yes" : "no") << "\n";
+    out << "  total length:   " << static_cast<unsigned long>(totalLength) << "\n";
+    if (minX <= maxX) {
+        out << "  bounds:         " << minX << "," << minY << " - " << maxX << "," << maxY
+            << "\n";
+    }
+    out << "  parse errors:   " << errors.size() << "\n";
+    return errors.empty();
+}
+
+bool normalize(const std::string& filename, std::ostream& out)
+{
+    std::vector<ParseError> errors;
+    LevelData data = readLevelFile(filename, errors);
+    reportParseErrors(filename, errors, out);
+    if (!errors.empty()) {
+        // Rewriting would silently drop whatever couldn't be parsed
+        out << filename << ": not normalized due to parse errors\n";
+        return false;
+    }
+    const auto removed = removeRedundantLines(data.lines);
+    for (auto& m : data.movingObjects) {
+        std::erase_if(m.lines, isZeroLength);
+    }
+    std::erase_if(data.movingObjects, [](const MovingObject& m) { return m.lines.empty(); });
+    writeLevelFile(filename, data);
+    out << filename << ": removed " << removed << " redundant line(s)\n";
+    return true;
+}
+
+bool simplify(const std::string& filename, float tolerance, std::ostream& out)
+{
+    std::vector<ParseError> errors;
+    LevelData data = readLevelFile(filename, errors);
+    reportParseErrors(filename, errors, out);
+    if (!errors.empty()) {
+        out << filename << ": not simplified due to parse errors\n";
+        return false;
+    }
+    const auto before = data.lines.size();
+    const auto removed = simplifyLines(data.lines, tolerance);
+    writeLevelFile(filename, data);
+    out << filename << ": removed " << removed << " of " << before << " line(s)\n";
+    return true;
+}
+
+bool convert(const std::string& from, const std::string& to, std::ostream& out)
+{
+    std::vector<ParseError> errors;
+    convertLevelFile(from, to, errors);
+    reportParseErrors(from, errors, out);
+    out << from << " -> " << to << "\n";
+    return errors.empty();
+}
+
+constexpr std::array<std::string_view, 5> commandNames {
+    "check", "stats", "normalize", "simplify", "convert"
+};
+
+} // namespace
+
+namespace mgo {
+
+void printUsage()
+{
+    std::cout << "Usage: level_designer <filename>\n"
+                 "       level_designer check <files...>\n"
+                 "       level_designer stats <files...>\n"
+                 "       level_designer normalize <files...>\n"
+                 "       level_designer simplify [--tolerance <units>] <files...>\n"
+                 "       level_designer convert <from> <to>\n"
+                 "       level_designer convert --to <lvl|lvb> <files...>\n\n"
+                 "If the file to edit doesn't exist it will be created on save.\n"
+                 "The format is chosen by extension: .lvb is binary, anything else text.\n\n";
+}
+
+bool isCommand(int argc, char* argv[])
+{
+    return argc >= 2
+        && std::find(commandNames.begin(), commandNames.end(), std::string_view(argv[1]))
+        != commandNames.end();
+}
+
+int runCommand(int argc, char* argv[])
+{
+    const std::string_view command = argv[1];
+    std::vector<std::string> args(argv + 2, argv + argc);
+    if (command == "convert") {
+        if (args.size() >= 3 && args[0] == "--to") {
+            const std::string extension = "." + args[1];
+            std::vector<std::string> files(args.begin() + 2, args.end());
+            return processFiles(files, [&](const std::string& filename, std::ostream& out) {
+                return convert(
+                    filename,
+                    std::filesystem::path(filename).replace_extension(extension).string(),
+                    out);
+            });
+        }
+        if (args.size() == 2) {
+            return convert(args[0], args[1], std::cout) ? 0 : 1;
+        }
+        printUsage();
+        return 1;
+    }
+    if (command == "simplify") {
+        float tolerance = 1.f;
+        if (args.size() >= 2 && args[0] == "--tolerance") {
+            const auto parsed = utils::parseFloat(args[1]);
+            if (!parsed.has_value() || *parsed < 0.f) {
+                std::cout << "Invalid tolerance " << args[1] << "\n";
+                printUsage();
+                return 1;
+            }
+            tolerance = *parsed;
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        if (args.empty()) {
+            printUsage();
+            return 1;
+        }
+        return processFiles(args, [&](const std::string& filename, std::ostream& out) {
+            return simplify(filename, tolerance, out);
+        });
+    }
+    if (args.empty()) {
+        printUsage();
+        return 1;
+    }
+    if (command == "check") {
+        return processFiles(args, check);
+    }
+    if (command == "stats") {
+        return processFiles(args, stats);
+    }
+    return processFiles(args, normalize);
+}
+
+} // namespace mgo
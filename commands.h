@@ -0,0 +1,18 @@
+#pragma once
+
+namespace mgo {
+
+// Headless subcommands for batch processing of level files, e.g.
+//   level_designer check *.lvl
+// These never open a window or load the font, so can run on machines without a display.
+
+// True if the command line names one of the subcommands rather than a file to edit
+bool isCommand(int argc, char* argv[]);
+
+// Returns the process exit code
+int runCommand(int argc, char* argv[]);
+
+// Describes how to run both the editor and the subcommands
+void printUsage();
+
+} // namespace mgo
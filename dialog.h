@@ -1,6 +1,5 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>
 #include <string>
 
 enum class InputType {
@@ -8,11 +7,17 @@ enum class InputType {
     numeric
 };
 
-std::string getInputFromDialog(
-    sf::RenderWindow& window,
-    sf::View& view,
-    sf::Font& font,
-    const std::string& prompt,
-    const std::string& defaultEntry = "",
-    InputType inputType = InputType::string
-);
\ No newline at end of file
+// What's typed into an input dialog. The default entry is shown until a key is pressed,
+// and is replaced rather than added to unless Enter is pressed straight away.
+class TextInput {
+public:
+    TextInput(const std::string& defaultEntry, InputType inputType);
+    // Takes a character typed (from sf::Event::TextEntered); Enter is left to the caller
+    void textEntered(char32_t keyPress);
+    const std::string& text() const { return m_input; }
+
+private:
+    std::string m_input;
+    InputType m_inputType;
+    bool m_firstKeyPress { true };
+};
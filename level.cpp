@@ -1,25 +1,135 @@
 #include "level.h"
 #include "dialog.h"
+#include "levelfile.h"
+#include "profiler.h"
+#include "simplify.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
-#include <fstream>
 #include <functional>
-#include <ios>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <tuple>
 
-#include <boost/algorithm/string/classification.hpp>
-#include <boost/algorithm/string/split.hpp>
+namespace {
+
+sf::Color lineColour(const mgo::Line& l)
+{
+    return { l.r, l.g, l.b };
+}
+
+// The corners of a diamond of the given size centred on the cursor, for finding the lines
+// which pass through it
+std::vector<std::pair<int, int>> cursorDiamond(float x, float y, float size)
+{
+    const auto cx = static_cast<int>(x);
+    const auto cy = static_cast<int>(y);
+    return { { static_cast<int>(x - size), cy },
+             { cx, static_cast<int>(y - size) },
+             { static_cast<int>(x + size), cy },
+             { cx, static_cast<int>(y + size) } };
+}
+
+// Allows std::visit to take a set of lambdas, one per alternative
+template <typename... Ts> struct Overloaded : Ts... {
+    using Ts::operator()...;
+};
+
+// Deleted lines are compacted away once there are at least this many of them, and they
+// make up at least this proportion of all lines
+constexpr std::size_t compactionMinimumTombstones = 1024;
+constexpr double compactionTombstoneFraction = 0.25;
+
+// Calls fn with a reference to every index into m_lines held in the undo history
+template <typename Fn> void forEachHistoryLineIndex(std::vector<mgo::Action>& history, Fn&& fn)
+{
+    for (auto& action : history) {
+        std::visit(
+            [&](auto& a) {
+                if constexpr (requires { a.indices; }) {
+                    for (auto& i : a.indices) {
+                        fn(i);
+                    }
+                }
+                if constexpr (requires { a.replacements; }) {
+                    for (auto& i : a.replacements) {
+                        fn(i);
+                    }
+                }
+            },
+            action);
+    }
+}
+
+std::uint64_t endpointKey(int x, int y)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32)
+        | static_cast<std::uint32_t>(y);
+}
+
+// Approximate, as each glyph is a quad of two triangles
+[[maybe_unused]] std::size_t textVertexCount(const sf::Text& text)
+{
+    return 6 * text.getString().getSize();
+}
+
+// Above this fraction of moving objects in view, culling costs more than it saves
+constexpr double cullingMaxVisibleFraction = 0.5;
+
+// Lines near the cursor are tested for picking in batches of this many
+constexpr std::size_t pickingBatchSize = 32;
+
+// Spacing of the grid lines, which new lines snap to
+constexpr int gridSpacing = 50;
+
+// Zoomed out, every other grid line is dropped until they're at least this far apart on screen
+constexpr float minGridLinePixels = 8.f;
+
+// The workspace always covers this, and extends to hold the level's content plus the margin
+const sf::FloatRect defaultWorkspace { { 0.f, 0.f }, { 2000.f, 2000.f } };
+constexpr float workspaceMargin = 500.f;
+
+// The area of the workspace shown by a view (which is never rotated)
+sf::FloatRect visibleArea(const sf::View& view)
+{
+    return sf::FloatRect(view.getCenter() - view.getSize() / 2.f, view.getSize());
+}
+
+// Unlike FloatRect::findIntersection, this counts touching edges and zero-width rectangles
+bool overlaps(const sf::FloatRect& a, const sf::FloatRect& b)
+{
+    return a.position.x <= b.position.x + b.size.x && b.position.x <= a.position.x + a.size.x
+        && a.position.y <= b.position.y + b.size.y && b.position.y <= a.position.y + a.size.y;
+}
+
+void appendLine(sf::VertexArray& vertices, const mgo::Line& l, sf::Color colour)
+{
+    vertices.append({ sf::Vector2f(l.x0, l.y0), colour });
+    vertices.append({ sf::Vector2f(l.x1, l.y1), colour });
+}
+
+} // namespace
 
 namespace mgo {
 mgo::Level::Level(sf::Window& window, unsigned windowWidth, unsigned windowHeight)
-    : m_window(window)
+    : Level(windowWidth, windowHeight)
+{
+    m_window = &window;
+}
+
+mgo::Level::Level(unsigned windowWidth, unsigned windowHeight)
+    : m_window(nullptr)
+    , m_lineLod(m_lines, [this](int x, int y) { return linesAt(x, y); })
     , m_dialogTitle(m_font)
     , m_dialogText(m_font)
+    , m_dialogInputText(m_font)
     , m_editModeText(m_font)
 {
     if (!m_font.openFromFile("DroidSansMono.ttf")) {
@@ -41,202 +151,175 @@ mgo::Level::Level(sf::Window& window, unsigned windowWidth, unsigned windowHeigh
 
 void Level::load(const std::string& filename)
 {
-    // Note, this is likely to break if the format of the file is incorrect, there's
-    // no checking for size of vectors below currently. Which is reasonable as this
-    // program should be creating the files being imported.
     m_fileName = filename;
     if (!std::filesystem::exists(filename)) {
         // file doesn't exist, so we save the name and will write to it when we save
         return;
     }
-
-    std::ifstream in(filename);
-    if (!in) {
-        throw(std::runtime_error("Failed to load Level file " + filename));
+    std::vector<ParseError> errors;
+    LevelData data = readLevelFile(filename, errors);
+    for (const auto& e : errors) {
+        std::cout << filename << ":" << e.lineNumber << ": " << e.message << "\n";
     }
-    std::string currentLine;
-    enum class ObjectType {
-        OBSTRUCTION,
-        EXIT,
-        FUEL,
-        BREAKABLE,
-        MOVING
-    };
-    ObjectType currentObject = ObjectType::OBSTRUCTION;
-    while (!in.eof()) {
-        getline(in, currentLine);
-        std::vector<std::string> vec;
-        boost::split(vec, currentLine, boost::is_any_of("~"));
-        if (vec.size() == 0) {
-            continue;
-        }
-        // When we get here, vec is a vector of all the items on the current line.
-        const char c = vec[0][0];
-        switch (c) {
-            case '!': // timelimit (unused), fuel (unused) , ship x, ship y, angle, description
-                if (vec.size() < 7) {
-                    throw std::runtime_error("Invalid first line of level file");
-                }
-                m_startPosition = { static_cast<unsigned>(stoi(vec[3])),
-                                    static_cast<unsigned>(stoi(vec[4])),
-                                    static_cast<unsigned>(stoi(vec[5])) };
-                m_levelDescription = vec[6];
-                m_window.setTitle(m_fileName + " - " + m_levelDescription);
-                break;
-            case 'N': // New object, parameter 1 is type, parameter 2 appears unused
-                if (vec[1] == "OBSTRUCTION") {
-                    currentObject = ObjectType::OBSTRUCTION;
-                } else if (vec[1] == "EXIT") {
-                    currentObject = ObjectType::EXIT;
-                } else if (vec[1] == "FUEL") {
-                    currentObject = ObjectType::FUEL;
-                } else if (vec[1] == "BREAKABLE") {
-                    currentObject = ObjectType::BREAKABLE;
-                } else if (vec[1] == "MOVING") {
-                    currentObject = ObjectType::MOVING;
-                    if (m_currentMovingObject.lines.size() > 0) {
-                        m_movingObjects.push_back(m_currentMovingObject);
-                        m_currentMovingObject.lines.clear();
-                    }
-                    m_currentMovingObject.xDelta = std::stof(vec[3]);
-                    m_currentMovingObject.xMaxDifference = std::stof(vec[4]);
-                    m_currentMovingObject.yDelta = std::stof(vec[5]);
-                    m_currentMovingObject.yMaxDifference = std::stof(vec[6]);
-                    m_currentMovingObject.rotationDelta = std::stof(vec[7]);
-                    if (vec.size() > 8) {
-                        m_currentMovingObject.gravity = std::stof(vec[8]);
-                    }
-                } else {
-                    std::cout << "Unrecognised object type '" << vec[1] << "' in file\n";
-                }
-                break;
-            case 'L':
-                {
-                    const unsigned x0 = std::stoi(vec[1]);
-                    const unsigned y0 = std::stoi(vec[2]);
-                    const unsigned x1 = std::stoi(vec[3]);
-                    const unsigned y1 = std::stoi(vec[4]);
-                    const uint8_t r = std::stoi(vec[5]);
-                    const uint8_t g = std::stoi(vec[6]);
-                    const uint8_t b = std::stoi(vec[7]);
-                    if (currentObject == ObjectType::OBSTRUCTION) {
-                        m_lines.push_back({ x0, y0, x1, y1, r, g, b, 1, false, false });
-                    } else if (currentObject == ObjectType::BREAKABLE) {
-                        m_lines.push_back({ x0, y0, x1, y1, r, g, b, 1, false, true });
-                    } else if (currentObject == ObjectType::MOVING) {
-                        m_currentMovingObject.lines.push_back(
-                            { x0, y0, x1, y1, r, g, b, 1, false });
-                    }
-                    break;
-                }
-            case 'P': // position
-                if (currentObject == ObjectType::EXIT) {
-                    m_exitPosition = std::make_pair(stoi(vec[1]), stoi(vec[2]));
-                }
-                if (currentObject == ObjectType::FUEL) {
-                    m_fuelObjects.push_back(std::make_pair(stoi(vec[1]), stoi(vec[2])));
-                }
-                break;
-            case 'T': // text
-                break;
-            default:
-                break;
+    m_lines.assign(data.lines);
+    m_startPosition = data.startPosition;
+    m_exitPosition = data.exitPosition;
+    m_fuelObjects = std::move(data.fuelObjects);
+    m_movingObjects = std::move(data.movingObjects);
+    if (m_startPosition.has_value()) {
+        setTitle(data.description);
+    }
+    resetGeometryCaches();
+}
+
+LevelData Level::levelData() const
+{
+    LevelData data;
+    data.description = m_levelDescription;
+    data.lines.reserve(m_lines.size() - m_inactiveLineCount);
+    for (std::size_t idx = 0; idx < m_lines.size(); ++idx) {
+        if (!m_lines.inactive(idx)) {
+            data.lines.push_back(m_lines[idx]);
         }
-        currentLine.clear();
     }
+    data.startPosition = m_startPosition;
+    data.exitPosition = m_exitPosition;
+    data.fuelObjects = m_fuelObjects;
+    data.movingObjects = m_movingObjects;
+    // Is there a moving object in progress?
     if (m_currentMovingObject.lines.size() > 0) {
-        m_movingObjects.push_back(m_currentMovingObject);
-        m_currentMovingObject.lines.clear();
+        data.movingObjects.push_back(m_currentMovingObject);
     }
-    in.close();
+    return data;
 }
 
 void mgo::Level::save()
 {
     msgbox("Save File", "Saving to: " + m_fileName, [&](bool okPressed, const std::string&) {
         if (okPressed) {
-            std::ofstream outfile(m_fileName, std::ios::trunc);
-            // Header
-            // time limit, fuel, startX, startY, angle, title
-            unsigned startX = 0;
-            unsigned startY = 0;
-            unsigned rotation = 0;
-            if (m_startPosition.has_value()) {
-                startX = m_startPosition.value().x;
-                startY = m_startPosition.value().y;
-                rotation = m_startPosition.value().r;
-            }
-            outfile << "!~0~0~" << startX << "~" << startY << "~" << rotation << "~"
-                    << m_levelDescription << "\n";
-            outfile << "N~OBSTRUCTION~obstruction\n";
-            for (const auto& l : m_lines) {
-                if (!l.inactive && !l.breakable) {
-                    outfile << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1
-                            << "~255~0~0~2\n";
-                }
-            }
-            // Each breakable line is its own object
-            for (const auto& l : m_lines) {
-                if (!l.inactive && l.breakable) {
-                    outfile << "N~BREAKABLE~breakable\n";
-                    outfile << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1
-                            << "~255~150~50~6\n";
-                }
-            }
-            if (m_exitPosition.has_value()) {
-                outfile << "N~EXIT~exit\n"
-                           "T~EXIT~52~213~235~6\n"
-                           "P~"
-                        << m_exitPosition.value().first << "~" << m_exitPosition.value().second
-                        << "\n";
-            }
-            for (const auto& p : m_fuelObjects) {
-                outfile << "N~FUEL~fuel\n"
-                           "T~*~255~255~0~12\n"
-                           "P~"
-                        << p.first << "~" << p.second << "\n";
-            }
-            std::size_t counter = 0;
-            for (const auto& m : m_movingObjects) {
-                outfile << "N~MOVING~moving_" << counter;
-                outfile << "~" << m.xDelta << "~" << m.xMaxDifference << "~" << m.yDelta << "~"
-                        << m.yMaxDifference << "~" << m.rotationDelta << "~" << m.gravity << "\n";
-                for (const auto& l : m.lines) {
-                    outfile << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1 << "~"
-                            << static_cast<int>(l.r) << "~" << static_cast<int>(l.g) << "~"
-                            << static_cast<int>(l.b) << "~6\n";
-                }
-                ++counter;
-            }
-            // Is there a moving object in progress?
-            if (m_currentMovingObject.lines.size() > 0) {
-                outfile << "N~MOVING~moving_" << counter;
-                outfile << "~" << m_currentMovingObject.xDelta << "~"
-                        << m_currentMovingObject.xMaxDifference << "~"
-                        << m_currentMovingObject.yDelta << "~"
-                        << m_currentMovingObject.yMaxDifference << "~"
-                        << m_currentMovingObject.rotationDelta << "~"
-                        << m_currentMovingObject.gravity << "\n";
-                for (const auto& l : m_currentMovingObject.lines) {
-                    outfile << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1 << "~"
-                            << static_cast<int>(l.r) << "~" << static_cast<int>(l.g) << "~"
-                            << static_cast<int>(l.b) << "~6\n";
-                }
+            // One save at a time, so that they reach the file in the order they were made
+            waitForBackgroundSave();
+            try {
+                // The snapshot is a plain copy, leaving formatting and writing to the thread
+                m_savingGeneration = m_editGeneration;
+                m_backgroundSave = std::async(
+                    std::launch::async, [data = levelData(), fileName = m_fileName]() {
+                        const auto start = std::chrono::steady_clock::now();
+                        const std::size_t bytes = writeLevelFile(fileName, data);
+                        return SaveResult { bytes, std::chrono::steady_clock::now() - start };
+                    });
+            } catch (const std::exception& e) {
+                std::cout << e.what() << "\n";
             }
-            outfile.close();
-            m_dirty = false;
         }
     });
 }
 
-void mgo::Level::draw(sf::RenderWindow& window)
+void mgo::Level::pollBackgroundSave()
 {
-    std::size_t idx = 0;
-    for (const auto& l : m_lines) {
-        if (!l.inactive) {
-            drawLine(window, l, idx);
+    if (m_backgroundSave.valid()
+        && m_backgroundSave.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        finishBackgroundSave();
+    }
+}
+
+bool mgo::Level::waitForBackgroundSave()
+{
+    return !m_backgroundSave.valid() || finishBackgroundSave();
+}
+
+bool mgo::Level::finishBackgroundSave()
+{
+    try {
+        const SaveResult result = m_backgroundSave.get();
+        // Anything edited since the snapshot was taken is still unsaved
+        m_savedGeneration = m_savingGeneration;
+        std::cout << "Saved " << result.bytes << " bytes to " << m_fileName << " in "
+                  << result.elapsed.count() << " ms\n";
+        return true;
+    } catch (const std::exception& e) {
+        std::cout << e.what() << "\n";
+        m_saveError = e.what();
+        showSaveError();
+    }
+    return false;
+}
+
+void mgo::Level::showSaveError()
+{
+    if (m_saveError.has_value() && !m_isDialogActive) {
+        msgbox("Save Failed", *m_saveError, [](bool, const std::string&) { });
+        m_saveError.reset();
+        m_needsRedraw = true;
+    }
+}
+
+void mgo::Level::draw(sf::RenderTarget& window)
+{
+    PROFILE_PHASE(DRAW);
+    if (m_lineVerticesDirty) {
+        rebuildLineVertices();
+    }
+    if (m_movingObjectVerticesDirty) {
+        rebuildMovingObjectVertices();
+    }
+    if (m_selectionVerticesDirty) {
+        rebuildSelectionVertices();
+    }
+    // The lines are drawn from tiles rendered earlier, so only tiles coming into view, or
+    // with lines changed in them, need the lines themselves drawing. When they do, only the
+    // chunks of lines overlapping the tile are submitted.
+    const auto band = LineLod::bandForZoom(m_viewZoomLevel);
+    bool tracked = m_lineChunks.takeChangedAreas(m_changedLineAreas);
+    if (band.has_value()) {
+        // Simplified lines change over the whole of each chain an edit breaks up, which can
+        // reach well beyond the lines edited
+        m_lineLod.update(*band);
+        tracked = m_lineLod.takeChangedAreas(*band, m_changedLineAreas);
+    }
+    if (!tracked) {
+        m_lineTiles.invalidateAll();
+    } else {
+        for (const auto& area : m_changedLineAreas) {
+            m_lineTiles.invalidate(area);
+        }
+    }
+    m_lineTiles.draw(window, [&](sf::RenderTarget& target, const sf::FloatRect& area) {
+        if (band.has_value()) {
+            // Zoomed out far enough for the simplified lines to be indistinguishable
+            m_lineLod.draw(*band, target, area);
+        } else {
+            m_lineChunks.draw(target, area);
+        }
+    });
+    const sf::FloatRect visible = visibleArea(window.getView());
+    // The selection is drawn over the top at full detail, in one go, so the line chunks don't
+    // change when it does
+    if (m_selectionVertices.getVertexCount() > 0) {
+        window.draw(m_selectionVertices);
+        PROFILE_DRAW_CALL(m_selectionVertices.getVertexCount());
+    }
+    m_movingObjectBoundsGrid.query(
+        visible.position.x,
+        visible.position.y,
+        visible.position.x + visible.size.x,
+        visible.position.y + visible.size.y,
+        m_gridQueryResults);
+    if (m_gridQueryResults.size() > m_movingObjectVertexRanges.size() * cullingMaxVisibleFraction) {
+        window.draw(m_movingObjectVertices);
+        PROFILE_DRAW_CALL(m_movingObjectVertices.getVertexCount());
+    } else if (!m_gridQueryResults.empty()) {
+        m_visibleVertices.clear();
+        for (const std::size_t idx : m_gridQueryResults) {
+            const auto& range = m_movingObjectVertexRanges[idx];
+            if (overlaps(range.bounds, visible)) {
+                for (std::size_t i = range.first; i < range.first + range.count; ++i) {
+                    m_visibleVertices.append(m_movingObjectVertices[i]);
+                }
+            }
         }
-        ++idx;
+        window.draw(m_visibleVertices);
+        PROFILE_DRAW_CALL(m_visibleVertices.getVertexCount());
     }
     if (m_currentNearestSnapPoint.has_value()) {
         sf::CircleShape c;
@@ -247,40 +330,135 @@ void mgo::Level::draw(sf::RenderWindow& window)
         float y = std::get<1>(m_currentNearestSnapPoint.value());
         c.setPosition({ x, y });
         window.draw(c);
+        PROFILE_DRAW_CALL(c.getPointCount());
     }
+    // Items which are still being constructed are few in number, so these are
+    // simply regenerated each frame and submitted together
+    m_transientVertices.clear();
     if (m_currentInsertionLine.inactive == false) {
-        drawLine(window, m_currentInsertionLine, std::nullopt);
-    }
-    idx = 0;
-    for (const auto& m : m_movingObjects) {
-        drawMovingObjectBoundary(m, idx, window);
-        ++idx;
+        appendLine(m_transientVertices, m_currentInsertionLine, lineColour(m_currentInsertionLine));
     }
     for (const auto& l : m_currentMovingObject.lines) {
-        drawLine(window, l, std::nullopt);
+        appendLine(m_transientVertices, l, lineColour(l));
     }
     for (const auto& l : m_currentPolygon.lines) {
-        drawLine(window, l, std::nullopt);
+        appendLine(m_transientVertices, l, lineColour(l));
+    }
+    if (m_transientVertices.getVertexCount() > 0) {
+        window.draw(m_transientVertices);
+        PROFILE_DRAW_CALL(m_transientVertices.getVertexCount());
     }
 }
 
-void Level::drawMovingObjectBoundary(
-    const mgo::MovingObject& m,
-    size_t idx,
-    sf::RenderWindow& window)
+void Level::rebuildLineVertices()
 {
-    unsigned minX { std::numeric_limits<unsigned>::max() };
-    unsigned minY { std::numeric_limits<unsigned>::max() };
-    unsigned maxX { 0 };
-    unsigned maxY { 0 };
-    for (auto l : m.lines) {
-        if (m_highlightedMovingObjectIdx.has_value()
-            && m_highlightedMovingObjectIdx.value() == idx) {
-            l.r = 255;
-            l.g = 255;
-            l.b = 255;
+    m_lineChunks.clear();
+    m_lineVerticesDirty = false;
+    m_selectionVerticesDirty = true;
+    for (std::size_t idx = 0; idx < m_lines.size(); ++idx) {
+        updateLineVertices(idx);
+    }
+}
+
+void Level::updateLineVertices(std::size_t idx)
+{
+    if (m_lineVerticesDirty) {
+        return; // everything will be regenerated before the next draw anyway
+    }
+    if (m_highlightedLineIndices.contains(idx)) {
+        m_selectionVerticesDirty = true;
+    }
+    if (m_lines.inactive(idx)) {
+        m_lineChunks.remove(idx);
+        return;
+    }
+    const Line l = m_lines[idx];
+    m_lineChunks.set(idx, l, lineColour(l));
+}
+
+void Level::rebuildSelectionVertices()
+{
+    m_selectionVertices.clear();
+    for (const std::size_t idx : m_highlightedLineIndices.indices()) {
+        appendLine(m_selectionVertices, m_lines[idx], sf::Color::White);
+    }
+    m_selectionVerticesDirty = false;
+}
+
+void Level::rebuildMovingObjectVertices()
+{
+    // Only the objects which changed have their shapes worked out again; the rest are
+    // copied from the cache
+    m_movingObjectVertices.clear();
+    m_movingObjectVertexRanges.clear();
+    m_movingObjectBoundsGrid.clear();
+    for (std::size_t idx = 0; idx < m_movingObjects.size(); ++idx) {
+        const auto& m = m_movingObjects[idx];
+        const MovingObjectShape& shape = movingObjectShape(idx);
+        const std::size_t first = m_movingObjectVertices.getVertexCount();
+        const bool highlighted = m_highlightedMovingObjectIdx == idx;
+        for (const auto& l : m.lines) {
+            appendLine(m_movingObjectVertices, l, highlighted ? sf::Color::White : lineColour(l));
+        }
+        for (std::size_t i = 0; i < shape.envelope.getVertexCount(); ++i) {
+            m_movingObjectVertices.append(shape.envelope[i]);
+        }
+        const std::size_t count = m_movingObjectVertices.getVertexCount() - first;
+        m_movingObjectVertexRanges.push_back({ first, count, shape.bounds });
+        if (count > 0) {
+            const sf::FloatRect& b = shape.bounds;
+            m_movingObjectBoundsGrid.insertBounds(
+                idx, b.position.x, b.position.y, b.position.x + b.size.x, b.position.y + b.size.y);
         }
-        drawLine(window, l, std::nullopt);
+    }
+    m_movingObjectVerticesDirty = false;
+}
+
+void Level::recolourMovingObject(std::size_t idx)
+{
+    if (m_movingObjectVerticesDirty || idx >= m_movingObjectVertexRanges.size()) {
+        return; // everything will be regenerated before the next draw anyway
+    }
+    const auto& lines = m_movingObjects[idx].lines;
+    const bool highlighted = m_highlightedMovingObjectIdx == idx;
+    const std::size_t first = m_movingObjectVertexRanges[idx].first;
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        const sf::Color colour = highlighted ? sf::Color::White : lineColour(lines[i]);
+        m_movingObjectVertices[first + i * 2].color = colour;
+        m_movingObjectVertices[first + i * 2 + 1].color = colour;
+    }
+}
+
+void Level::highlightLine(std::size_t idx)
+{
+    if (m_highlightedLineIndices.insert(idx)) {
+        m_selectionVerticesDirty = true;
+    }
+}
+
+void Level::unhighlightLine(std::size_t idx)
+{
+    if (m_highlightedLineIndices.erase(idx)) {
+        m_selectionVerticesDirty = true;
+    }
+}
+
+void Level::clearHighlightedLines()
+{
+    if (!m_highlightedLineIndices.empty()) {
+        m_highlightedLineIndices.clear();
+        m_selectionVerticesDirty = true;
+    }
+}
+
+Level::MovingObjectShape Level::makeMovingObjectShape(const mgo::MovingObject& m)
+{
+    MovingObjectShape shape;
+    int minX { std::numeric_limits<int>::max() };
+    int minY { std::numeric_limits<int>::max() };
+    int maxX { std::numeric_limits<int>::lowest() };
+    int maxY { std::numeric_limits<int>::lowest() };
+    for (const auto& l : m.lines) {
         // Determine bounding box:
         if (l.x0 < minX) {
             minX = l.x0 - 1;
@@ -316,20 +494,19 @@ void Level::drawMovingObjectBoundary(
         maxY += m.yMaxDifference;
     }
 
+    const sf::Color boundaryColour { 128, 128, 0 };
+    auto& vertices = shape.envelope;
+    float centreX = minX + (maxX - minX) / 2;
+    float centreY = minY + (maxY - minY) / 2;
+    shape.centre = { centreX, centreY };
     if (m.rotationDelta == 0.f) {
-        Line l1 { minX, minY, minX, maxY, 128, 128, 0 };
-        drawLine(window, l1, std::nullopt);
-        Line l2 { minX, maxY, maxX, maxY, 128, 128, 0 };
-        drawLine(window, l2, std::nullopt);
-        Line l3 { maxX, maxY, maxX, minY, 128, 128, 0 };
-        drawLine(window, l3, std::nullopt);
-        Line l4 { minX, minY, maxX, minY, 128, 128, 0 };
-        drawLine(window, l4, std::nullopt);
+        appendLine(vertices, { minX, minY, minX, maxY }, boundaryColour);
+        appendLine(vertices, { minX, maxY, maxX, maxY }, boundaryColour);
+        appendLine(vertices, { maxX, maxY, maxX, minY }, boundaryColour);
+        appendLine(vertices, { minX, minY, maxX, minY }, boundaryColour);
     } else {
         // It's rotating, so we calculate the max radius by finding the vertex furthest from the
         // centre
-        float centreX = minX + (maxX - minX) / 2;
-        float centreY = minY + (maxY - minY) / 2;
         float maxRadius { 0.f };
         for (const auto& l : m.lines) {
             auto r = std::sqrt(
@@ -343,39 +520,72 @@ void Level::drawMovingObjectBoundary(
                 maxRadius = r;
             }
         }
+        shape.radius = maxRadius;
         if (m.xMaxDifference > 0.f || m.yMaxDifference > 0.f) {
             // Circumscribe all possible positions
-            drawRoundedRect(
-                window,
+            appendRoundedRect(
+                vertices,
                 centreX - m.xMaxDifference - maxRadius, // top left
                 centreY - m.yMaxDifference - maxRadius,
                 (centreX + m.xMaxDifference + maxRadius) - (centreX - m.xMaxDifference - maxRadius),
                 (centreY + m.yMaxDifference + maxRadius) - (centreY - m.yMaxDifference - maxRadius),
                 maxRadius,
-                128,
-                128,
-                0);
+                boundaryColour.r,
+                boundaryColour.g,
+                boundaryColour.b);
         } else {
             // It's just rotating, so we can simply draw a circle around it to show all possible
             // positions
-            drawCircle(maxRadius, centreX, centreY, window);
+            appendCircle(vertices, maxRadius, centreX, centreY);
         }
     }
+
+    // The bounds include the boundary drawn around the object's range of movement
+    sf::Vector2f min { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    sf::Vector2f max { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    auto include = [&](const sf::Vector2f& p) {
+        min = { std::min(min.x, p.x), std::min(min.y, p.y) };
+        max = { std::max(max.x, p.x), std::max(max.y, p.y) };
+    };
+    for (const auto& l : m.lines) {
+        include(sf::Vector2f(l.x0, l.y0));
+        include(sf::Vector2f(l.x1, l.y1));
+    }
+    for (std::size_t i = 0; i < vertices.getVertexCount(); ++i) {
+        include(vertices[i].position);
+    }
+    shape.bounds = sf::FloatRect(min, max - min);
+    return shape;
+}
+
+const Level::MovingObjectShape& Level::movingObjectShape(std::size_t idx)
+{
+    auto& shape = m_movingObjectShapes[idx];
+    if (!shape.has_value()) {
+        shape = makeMovingObjectShape(m_movingObjects[idx]);
+    }
+    return *shape;
 }
 
-void Level::drawCircle(float maxRadius, float centreX, float centreY, sf::RenderWindow& window)
+void Level::appendCircle(sf::VertexArray& vertices, float maxRadius, float centreX, float centreY)
 {
-    sf::CircleShape circle;
-    circle.setRadius(maxRadius);
-    circle.setOutlineColor({ 128, 128, 0 });
-    circle.setOutlineThickness(1);
-    circle.setFillColor(sf::Color::Transparent);
-    circle.setPosition({ centreX - maxRadius, centreY - maxRadius });
-    window.draw(circle);
+    constexpr unsigned segments = 30; // same as sf::CircleShape's default point count
+    constexpr float PI = 3.14159265f;
+    const sf::Color colour { 128, 128, 0 };
+    for (unsigned i = 0; i < segments; ++i) {
+        const float a0 = 2.f * PI * i / segments;
+        const float a1 = 2.f * PI * (i + 1) / segments;
+        vertices.append(
+            { { centreX + maxRadius * std::cos(a0), centreY + maxRadius * std::sin(a0) },
+              colour });
+        vertices.append(
+            { { centreX + maxRadius * std::cos(a1), centreY + maxRadius * std::sin(a1) },
+              colour });
+    }
 }
 
-void Level::drawRoundedRect(
-    sf::RenderWindow& window,
+void Level::appendRoundedRect(
+    sf::VertexArray& vertices,
     float x,
     float y,
     float w,
@@ -387,9 +597,8 @@ void Level::drawRoundedRect(
 {
     // Ensure radius isn't too big for size:
     r = std::min(r, std::min(w, h) / 2);
-    auto addLine = [&](unsigned x0, unsigned y0, unsigned x1, unsigned y1) {
-        Line line = { x0, y0, x1, y1, red, green, blue };
-        drawLine(window, line);
+    auto addLine = [&](int x0, int y0, int x1, int y1) {
+        appendLine(vertices, { x0, y0, x1, y1 }, { red, green, blue });
     };
     constexpr unsigned segments = 6; // Number of segments to approximate quarter circles
     addLine(x + r, y, x + w - r, y);
@@ -401,10 +610,10 @@ void Level::drawRoundedRect(
         for (unsigned i = 0; i < segments; ++i) {
             float a0 = startAngle + i * angleStep;
             float a1 = a0 + angleStep;
-            unsigned x0 = static_cast<unsigned>(cx + r * std::cos(a0));
-            unsigned y0 = static_cast<unsigned>(cy + r * std::sin(a0));
-            unsigned x1 = static_cast<unsigned>(cx + r * std::cos(a1));
-            unsigned y1 = static_cast<unsigned>(cy + r * std::sin(a1));
+            int x0 = static_cast<int>(cx + r * std::cos(a0));
+            int y0 = static_cast<int>(cy + r * std::sin(a0));
+            int x1 = static_cast<int>(cx + r * std::cos(a1));
+            int y1 = static_cast<int>(cy + r * std::sin(a1));
             addLine(x0, y0, x1, y1);
         }
     };
@@ -415,49 +624,111 @@ void Level::drawRoundedRect(
     drawArc(x + r, y + h - r, 0.5f * PI, PI);
 }
 
-void mgo::Level::drawDialog(sf::RenderWindow& window)
+void mgo::Level::drawDialog(sf::RenderTarget& window)
 {
     if (!m_isDialogActive) {
         return;
     }
     window.draw(m_dialog);
+    PROFILE_DRAW_CALL(m_dialog.getPointCount());
     window.draw(m_dialogTitle);
+    PROFILE_DRAW_CALL(textVertexCount(m_dialogTitle));
     window.draw(m_dialogText);
+    PROFILE_DRAW_CALL(textVertexCount(m_dialogText));
+    if (m_dialogInput.has_value()) {
+        window.draw(m_dialogInputBox);
+        PROFILE_DRAW_CALL(m_dialogInputBox.getPointCount());
+        window.draw(m_dialogInputText);
+        PROFILE_DRAW_CALL(textVertexCount(m_dialogInputText));
+    }
 }
 
-void mgo::Level::drawLine(sf::RenderWindow& window, const Line& l, std::optional<std::size_t> idx)
+void mgo::Level::drawGridLines(sf::RenderTarget& window)
 {
-    sf::Vertex line[]
-        = { sf::Vertex(sf::Vector2f(l.x0, l.y0)), sf::Vertex(sf::Vector2f(l.x1, l.y1)) };
-    bool highlighted = false;
-    if (idx.has_value()) {
-        for (const size_t i : m_highlightedLineIndices) {
-            if (i == *idx) {
-                highlighted = true;
-                break;
-            }
-        }
+    PROFILE_PHASE(GRID_LINES);
+    // The grid covers the workspace and is held as one set of vertices, only built again when
+    // the workspace grows or zooming changes how many of the lines are shown
+    const sf::FloatRect workspace = workspaceBounds();
+    const float pixelsPerUnit
+        = static_cast<float>(window.getSize().x) / window.getView().getSize().x;
+    int spacing = gridSpacing;
+    while (spacing * pixelsPerUnit < minGridLinePixels
+           && spacing < workspace.size.x + workspace.size.y) {
+        spacing *= 2;
     }
-    if (highlighted) {
-        line[0].color = sf::Color(sf::Color::White);
-        line[1].color = sf::Color(sf::Color::White);
-    } else {
-        line[0].color = sf::Color(l.r, l.g, l.b);
-        line[1].color = sf::Color(l.r, l.g, l.b);
+    if (spacing != m_gridVerticesSpacing || workspace != m_gridArea) {
+        // Lines stay on multiples of the spacing, so those shown zoomed out are still ones
+        // new lines snap to
+        auto gridLineBelow = [spacing](float v) {
+            return static_cast<int>(std::floor(v / spacing)) * spacing;
+        };
+        auto gridLineAbove = [spacing](float v) {
+            return static_cast<int>(std::ceil(v / spacing)) * spacing;
+        };
+        const int left = gridLineBelow(workspace.position.x);
+        const int top = gridLineBelow(workspace.position.y);
+        const int right = gridLineAbove(workspace.position.x + workspace.size.x);
+        const int bottom = gridLineAbove(workspace.position.y + workspace.size.y);
+        const sf::Color colour { 0, 100, 0 };
+        m_gridVertices.clear();
+        for (int n = left; n <= right; n += spacing) {
+            appendLine(m_gridVertices, { n, top, n, bottom }, colour);
+        }
+        for (int n = top; n <= bottom; n += spacing) {
+            appendLine(m_gridVertices, { left, n, right, n }, colour);
+        }
+        m_gridVerticesSpacing = spacing;
+        m_gridArea = workspace;
     }
-    window.draw(line, 2, sf::PrimitiveType::Lines);
+    window.draw(m_gridVertices);
+    PROFILE_DRAW_CALL(m_gridVertices.getVertexCount());
 }
 
-void mgo::Level::drawGridLines(sf::RenderWindow& window)
+sf::FloatRect Level::workspaceBounds()
 {
-    for (unsigned n = 0; n <= 2000; n += 50) {
-        drawLine(window, { n, 0, n, 2000, 0, 100, 0, 1 }, std::nullopt);
-        drawLine(window, { 0, n, 2000, n, 0, 100, 0, 1 }, std::nullopt);
+    // The default area, grown to take in everything in the level with a margin to draw into
+    sf::FloatRect content = defaultWorkspace;
+    auto include = [&content](const sf::FloatRect& r) {
+        const sf::Vector2f margin(workspaceMargin, workspaceMargin);
+        const sf::Vector2f rMin = r.position - margin;
+        const sf::Vector2f rMax = r.position + r.size + margin;
+        const sf::Vector2f cMax = content.position + content.size;
+        const sf::Vector2f min(
+            std::min(content.position.x, rMin.x), std::min(content.position.y, rMin.y));
+        const sf::Vector2f max(std::max(cMax.x, rMax.x), std::max(cMax.y, rMax.y));
+        content = { min, max - min };
+    };
+    if (m_lineVerticesDirty) {
+        rebuildLineVertices();
+    }
+    if (const auto lineBounds = m_lineChunks.bounds()) {
+        include(*lineBounds);
+    }
+    if (m_movingObjectVerticesDirty) {
+        rebuildMovingObjectVertices();
+    }
+    for (const auto& range : m_movingObjectVertexRanges) {
+        if (range.count > 0) {
+            include(range.bounds);
+        }
     }
+    auto includePoint = [&include](int x, int y) {
+        include({ { static_cast<float>(x), static_cast<float>(y) }, { 0.f, 0.f } });
+    };
+    if (m_startPosition.has_value()) {
+        includePoint(m_startPosition->x, m_startPosition->y);
+    }
+    if (m_exitPosition.has_value()) {
+        includePoint(m_exitPosition->first, m_exitPosition->second);
+    }
+    for (const auto& [x, y] : m_fuelObjects) {
+        includePoint(x, y);
+    }
+    return content;
 }
 
 std::optional<std::size_t>
-Level::lineUnderCursor(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY)
+Level::lineUnderCursor(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY)
 {
     // Note mouseX and mouseY are *window* coordinates, these need to be converted into
     // workspace coordinates.
@@ -465,111 +736,101 @@ Level::lineUnderCursor(sf::RenderWindow& window, unsigned mouseX, unsigned mouse
     // of these to see if they intersect any line on the workspace.
     // A positive origin e.g. 10,10 means the top left of the window is at, say, 10,10 on
     // the workspace, i.e. the workspace is slightly off screen to the left.
+    // Only lines passing near the cursor (according to the spatial index) are tested.
     const auto w = window.mapPixelToCoords({ static_cast<int>(mouseX), static_cast<int>(mouseY) });
-    std::size_t idx = 0;
     const float selectionBoxSize = 1 + 4 * m_viewZoomLevel;
-    for (const auto& l : m_lines) {
-        if (!l.inactive) {
-            if (utils::doLinesIntersect(
-                    w.x - selectionBoxSize,
-                    w.y,
-                    w.x,
-                    w.y - selectionBoxSize,
-                    l.x0,
-                    l.y0,
-                    l.x1,
-                    l.y1)) {
-                return idx;
-            }
-            if (utils::doLinesIntersect(
-                    w.x,
-                    w.y - selectionBoxSize,
-                    w.x + selectionBoxSize,
-                    w.y,
-                    l.x0,
-                    l.y0,
-                    l.x1,
-                    l.y1)) {
-                return idx;
-            }
-            if (utils::doLinesIntersect(
-                    w.x + selectionBoxSize,
-                    w.y,
-                    w.x,
-                    w.y + selectionBoxSize,
-                    l.x0,
-                    l.y0,
-                    l.x1,
-                    l.y1)) {
-                return idx;
-            }
-            if (utils::doLinesIntersect(
-                    w.x,
-                    w.y + selectionBoxSize,
-                    w.x - selectionBoxSize,
-                    w.y,
-                    l.x0,
-                    l.y0,
-                    l.x1,
-                    l.y1)) {
-                return idx;
+    m_lineGrid.query(
+        w.x - selectionBoxSize,
+        w.y - selectionBoxSize,
+        w.x + selectionBoxSize,
+        w.y + selectionBoxSize,
+        m_gridQueryResults);
+    // Tested a batch at a time, so the search can stop at the first batch with a hit
+    const auto diamond = cursorDiamond(w.x, w.y, selectionBoxSize);
+    std::size_t next = 0;
+    while (next < m_gridQueryResults.size()) {
+        m_segmentBatch.clear();
+        m_segmentBatchIds.clear();
+        for (; next < m_gridQueryResults.size() && m_segmentBatch.size() < pickingBatchSize;
+             ++next) {
+            const std::size_t idx = m_gridQueryResults[next];
+            if (!m_lines.inactive(idx)) {
+                m_segmentBatch.push_back(m_lines[idx]);
+                m_segmentBatchIds.push_back(idx);
             }
         }
-        ++idx;
+        if (const auto i = m_segmentBatch.firstCrossing(diamond)) {
+            return m_segmentBatchIds[*i];
+        }
     }
     return std::nullopt;
 }
 
 std::optional<std::size_t>
-Level::movingObjectUnderCursor(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY)
+Level::movingObjectUnderCursor(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY)
 {
     // Note, this returns the index of the entire moving object, not the individual line
     const auto w = window.mapPixelToCoords({ static_cast<int>(mouseX), static_cast<int>(mouseY) });
-    std::size_t idx = 0;
-    for (const auto& m : m_movingObjects) {
-        for (const auto& l : m.lines) {
-            if (!l.inactive) {
-                if (utils::doLinesIntersect(w.x - 10, w.y, w.x, w.y - 10, l.x0, l.y0, l.x1, l.y1)) {
-                    return idx;
-                }
-                if (utils::doLinesIntersect(w.x, w.y - 10, w.x + 10, w.y, l.x0, l.y0, l.x1, l.y1)) {
-                    return idx;
-                }
-                if (utils::doLinesIntersect(w.x + 10, w.y, w.x, w.y + 10, l.x0, l.y0, l.x1, l.y1)) {
-                    return idx;
-                }
-                if (utils::doLinesIntersect(w.x, w.y + 10, w.x - 10, w.y, l.x0, l.y0, l.x1, l.y1)) {
-                    return idx;
-                }
-            }
-        }
-        ++idx;
+    if (m_movingObjectGridDirty) {
+        rebuildMovingObjectGrid();
+    }
+    m_movingObjectGrid.query(w.x - 10, w.y - 10, w.x + 10, w.y + 10, m_gridQueryResults);
+    m_segmentBatch.clear();
+    m_segmentBatchIds.clear();
+    for (const std::size_t ref : m_gridQueryResults) {
+        const auto [obj, line] = m_movingObjectLineRefs[ref];
+        m_segmentBatch.push_back(m_movingObjects[obj].lines[line]);
+        m_segmentBatchIds.push_back(obj);
+    }
+    if (const auto i = m_segmentBatch.firstCrossing(cursorDiamond(w.x, w.y, 10))) {
+        return m_segmentBatchIds[*i];
     }
     return std::nullopt;
 }
 
 void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
 {
+    // Nothing is part way through using line indices between events, so this is a safe
+    // point to tidy up deleted lines
+    compactLinesIfNeeded();
+    // Anything other than the mouse moving could change what's on screen. Mouse movement
+    // only needs a redraw if it changes the view or the cursor feedback (checked below).
+    if (!event.is<sf::Event::MouseMoved>()) {
+        m_needsRedraw = true;
+    }
     if (event.is<sf::Event::Closed>()) {
         quit(window);
     }
     if (m_isDialogActive) {
         // if a dialog is active then we respond differently to events:
         if (event.is<sf::Event::KeyPressed>()) {
+            m_dialogKeyPressed = true;
+            // The callback may open another dialog, replacing this one's callback and input
+            const auto callback = m_dialogCallback;
             const auto scancode = event.getIf<sf::Event::KeyPressed>()->scancode;
             switch (scancode) {
                 case sf::Keyboard::Scancode::Escape:
                     m_isDialogActive = false;
-                    m_dialogCallback(false, "");
+                    callback(false, "");
                     break;
                 case sf::Keyboard::Scancode::Enter:
-                    m_isDialogActive = false;
-                    m_dialogCallback(true, "");
-                    break;
+                    {
+                        const std::string input
+                            = m_dialogInput.has_value() ? m_dialogInput->text() : "";
+                        m_isDialogActive = false;
+                        callback(true, input);
+                        break;
+                    }
                 default:
                     break;
             }
+        } else if (event.is<sf::Event::TextEntered>() && m_dialogInput.has_value()
+                   && m_dialogKeyPressed) {
+            m_dialogInput->textEntered(event.getIf<sf::Event::TextEntered>()->unicode);
+            m_dialogInputText.setString(m_dialogInput->text() + "_");
         }
+        // A save may have failed while the dialog was open, e.g. one waited for on closing it
+        showSaveError();
         return;
     }
     if (event.is<sf::Event::KeyPressed>()) {
@@ -607,30 +868,49 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
         } else {
             switch (scancode) {
                 case sf::Keyboard::Scancode::V:
-                    {
-                        // Convert selected lines to a movable object
-                        if (!m_highlightedLineIndices.empty()) {
-                            MovingObject m;
-                            for (std::size_t i : m_highlightedLineIndices) {
-                                m_lines[i].r = 255;
-                                m_lines[i].g = 172;
-                                m_lines[i].b = 163;
-                                m.lines.push_back(m_lines[i]);
-                                m_lines[i].inactive = true;
-                            }
-                            m_movingObjects.push_back(m);
-                        }
-                    }
+                    convertHighlightedLines();
                     break;
                 case sf::Keyboard::Scancode::T:
                     {
-                        std::string title = getInputFromDialog(
-                            window, m_fixedView, m_font, "Enter Level Title", m_levelDescription);
-                        if (!title.empty()) {
-                            m_levelDescription = title;
-                            m_window.setTitle(m_fileName + " - " + m_levelDescription);
-                            m_dirty = true;
-                        }
+                        inputbox(
+                            "Enter Level Title",
+                            m_levelDescription,
+                            InputType::string,
+                            [this](bool, const std::string& title) {
+                                if (!title.empty()) {
+                                    addReplayItem(SetTitleAction { m_levelDescription, title });
+                                    setTitle(title);
+                                    ++m_editGeneration;
+                                }
+                            });
+                        break;
+                    }
+                case sf::Keyboard::Scancode::O:
+                    {
+                        // Optimise the level by merging and removing redundant lines
+                        inputbox(
+                            "Enter Simplification Tolerance (0 = exactly collinear only)",
+                            "1.0",
+                            InputType::numeric,
+                            [this](bool, const std::string& s) {
+                                if (s.empty()) {
+                                    return;
+                                }
+                                const auto tolerance = utils::parseFloat(s);
+                                if (!tolerance.has_value()) {
+                                    msgbox(
+                                        "Simplify",
+                                        s + " isn't a valid tolerance",
+                                        [](bool, const std::string&) { });
+                                    return;
+                                }
+                                const std::size_t removed
+                                    = simplifyLines(std::max(0.f, *tolerance));
+                                msgbox(
+                                    "Simplify",
+                                    "Removed " + std::to_string(removed) + " line(s)",
+                                    [](bool, const std::string&) { });
+                            });
                         break;
                     }
                 case sf::Keyboard::Scancode::Equal:
@@ -660,32 +940,15 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                         redo();
                     } else {
                         if (m_highlightedMovingObjectIdx.has_value()) {
-                            auto& obj = m_movingObjects[m_highlightedMovingObjectIdx.value()];
                             // Edit moving object's Y delta and max
-                            std::string s = getInputFromDialog(
-                                window,
-                                m_fixedView,
-                                m_font,
-                                "Enter Y Delta",
-                                utils::to_string_with_precision(obj.yDelta, 1),
-                                InputType::numeric);
-                            if (!s.empty()) {
-                                float delta = std::stof(s);
-                                obj.yDelta = delta;
-                                m_dirty = true;
-                            }
-                            s = getInputFromDialog(
-                                window,
-                                m_fixedView,
-                                m_font,
-                                "Enter Y +/- Max Motion (Squares = 50)",
-                                utils::to_string_with_precision(obj.yMaxDifference, 1),
-                                InputType::numeric);
-                            if (!s.empty()) {
-                                float diff = std::stof(s);
-                                obj.yMaxDifference = diff;
-                                m_dirty = true;
-                            }
+                            const std::size_t idx = m_highlightedMovingObjectIdx.value();
+                            editMovingObjectProperty(
+                                idx, &MovingObject::yDelta, "Enter Y Delta", [this, idx]() {
+                                    editMovingObjectProperty(
+                                        idx,
+                                        &MovingObject::yMaxDifference,
+                                        "Enter Y +/- Max Motion (Squares = 50)");
+                                });
                         }
                     }
                     break;
@@ -697,19 +960,18 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                     break;
                 case sf::Keyboard::Scancode::Backspace:
                 case sf::Keyboard::Scancode::Delete:
-                    for (const size_t i : m_highlightedLineIndices) {
-                        m_lines[i].inactive = true;
-                        addReplayItem({ Mode::EDIT, i });
+                    if (!m_highlightedLineIndices.empty()) {
+                        std::vector<std::size_t> indices = m_highlightedLineIndices.sorted();
+                        clearHighlightedLines();
+                        deleteLines(std::move(indices));
                     }
-                    m_highlightedLineIndices.clear();
-                    m_dirty = true;
                     if (m_highlightedMovingObjectIdx.has_value()) {
-                        m_movingObjects.erase(
-                            m_movingObjects.begin() + m_highlightedMovingObjectIdx.value());
-                        // TODO: not sure if this will work yet:
-                        addReplayItem({ Mode::EDIT, m_highlightedMovingObjectIdx.value() });
+                        const std::size_t idx = m_highlightedMovingObjectIdx.value();
+                        DeleteMovingObjectAction action { idx, m_movingObjects[idx] };
                         m_highlightedMovingObjectIdx = std::nullopt;
-                        m_dirty = true;
+                        applyAction(action);
+                        addReplayItem(std::move(action));
+                        ++m_editGeneration;
                     }
                     break;
                 case sf::Keyboard::Scancode::Escape:
@@ -747,67 +1009,32 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                 case sf::Keyboard::Scancode::X:
                     // Edit moving object's X delta and max difference
                     if (m_highlightedMovingObjectIdx.has_value()) {
-                        auto& obj = m_movingObjects[m_highlightedMovingObjectIdx.value()];
-                        std::string s = getInputFromDialog(
-                            window,
-                            m_fixedView,
-                            m_font,
-                            "Enter X Delta",
-                            utils::to_string_with_precision(obj.xDelta, 1),
-                            InputType::numeric);
-                        if (!s.empty()) {
-                            float delta = std::stof(s);
-                            obj.xDelta = delta;
-                            m_dirty = true;
-                        }
-                        s = getInputFromDialog(
-                            window,
-                            m_fixedView,
-                            m_font,
-                            "Enter X Max +/- Motion (Squares = 50)",
-                            utils::to_string_with_precision(obj.xMaxDifference, 1),
-                            InputType::numeric);
-                        if (!s.empty()) {
-                            float diff = std::stof(s);
-                            obj.xMaxDifference = diff;
-                            m_dirty = true;
-                        }
+                        const std::size_t idx = m_highlightedMovingObjectIdx.value();
+                        editMovingObjectProperty(
+                            idx, &MovingObject::xDelta, "Enter X Delta", [this, idx]() {
+                                editMovingObjectProperty(
+                                    idx,
+                                    &MovingObject::xMaxDifference,
+                                    "Enter X Max +/- Motion (Squares = 50)");
+                            });
                     }
                     break;
                 case sf::Keyboard::Scancode::G:
                     if (m_highlightedMovingObjectIdx.has_value()) {
-                        auto& obj = m_movingObjects[m_highlightedMovingObjectIdx.value()];
-                        std::string s = getInputFromDialog(
-                            window,
-                            m_fixedView,
-                            m_font,
-                            "Enter Gravity (between 10 and 100 is good)",
-                            utils::to_string_with_precision(obj.gravity, 1),
-                            InputType::numeric);
-                        if (!s.empty()) {
-                            float gravity = std::stof(s);
-                            obj.gravity = gravity;
-                            m_dirty = true;
-                        }
+                        editMovingObjectProperty(
+                            m_highlightedMovingObjectIdx.value(),
+                            &MovingObject::gravity,
+                            "Enter Gravity (between 10 and 100 is good)");
                     }
                     break;
                 // Note Y is handled above as it's also used with Cmd for Redo
                 case sf::Keyboard::Scancode::R:
                     // Edit moving object's rotation delta
                     if (m_highlightedMovingObjectIdx.has_value()) {
-                        auto& obj = m_movingObjects[m_highlightedMovingObjectIdx.value()];
-                        std::string s = getInputFromDialog(
-                            window,
-                            m_fixedView,
-                            m_font,
-                            "Enter Rotation delta",
-                            utils::to_string_with_precision(obj.rotationDelta, 1),
-                            InputType::numeric);
-                        if (!s.empty()) {
-                            float delta = std::stof(s);
-                            obj.rotationDelta = delta;
-                            m_dirty = true;
-                        }
+                        editMovingObjectProperty(
+                            m_highlightedMovingObjectIdx.value(),
+                            &MovingObject::rotationDelta,
+                            "Enter Rotation delta");
                     }
                     break;
                 default:
@@ -817,8 +1044,11 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
     }
     if (event.getIf<sf::Event::MouseMoved>()) {
         const auto mouseMove = event.getIf<sf::Event::MouseMoved>()->position;
+        const auto previousSnapPoint = m_currentNearestSnapPoint;
+        const Line previousInsertionLine = m_currentInsertionLine;
         if (sf::Keyboard::isKeyPressed(sf::Keyboard::Key::LShift)) {
             if (m_oldMouseX.has_value()) {
+                m_needsRedraw = true;
                 int xDelta = m_oldMouseX.value() - mouseMove.x;
                 int yDelta = m_oldMouseY.value() - mouseMove.y;
                 xDelta *= m_viewZoomLevel;
@@ -854,11 +1084,16 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                     *m_currentPolygon.centreX,
                     *m_currentPolygon.centreY,
                     m_currentPolygon.sides);
-
+                m_needsRedraw = true;
             } else {
                 m_currentNearestSnapPoint = std::nullopt;
             }
         }
+        if (m_currentNearestSnapPoint != previousSnapPoint
+            || m_currentInsertionLine.x1 != previousInsertionLine.x1
+            || m_currentInsertionLine.y1 != previousInsertionLine.y1) {
+            m_needsRedraw = true;
+        }
         m_oldMouseX = mouseMove.x;
         m_oldMouseY = mouseMove.y;
     }
@@ -892,26 +1127,20 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                                         l.g = 172;
                                         l.b = 163;
                                         m_currentMovingObject.lines.push_back(l);
+                                        addReplayItem(AddMovingObjectLineAction { l });
                                     } else {
-                                        m_lines.push_back(m_currentInsertionLine);
+                                        addReplayItem(
+                                            AddLinesAction { { addLine(m_currentInsertionLine) } });
                                     }
-                                    addReplayItem(
-                                        { m_currentMode,
-                                          0,
-                                          m_currentInsertionLine.x0,
-                                          m_currentInsertionLine.y0,
-                                          m_currentInsertionLine.x1,
-                                          m_currentInsertionLine.y1,
-                                          0 });
-                                    m_dirty = true;
+                                    ++m_editGeneration;
                                     // next line starts at the current line's end:
                                     m_currentInsertionLine.x0 = m_currentInsertionLine.x1;
                                     m_currentInsertionLine.y0 = m_currentInsertionLine.y1;
                                 }
                             } else {
                                 // else this is a new line
-                                unsigned x;
-                                unsigned y;
+                                int x;
+                                int y;
                                 if (!m_currentNearestSnapPoint.has_value()) {
                                     auto w = window.mapPixelToCoords(
                                         { static_cast<int>(mousePos.x),
@@ -933,9 +1162,10 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                     }
                 case Mode::EDIT:
                     {
+                        const auto previousMovingObjectIdx = m_highlightedMovingObjectIdx;
                         if (!(sf::Keyboard::isKeyPressed(sf::Keyboard::Key::LSystem)
                               || sf::Keyboard::isKeyPressed(sf::Keyboard::Key::RSystem))) {
-                            m_highlightedLineIndices.clear();
+                            clearHighlightedLines();
                         }
                         // Check to see if there is a line under the cursor
                         auto line = lineUnderCursor(window, mousePos.x, mousePos.y);
@@ -948,13 +1178,21 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                         if (line.has_value()) {
                             m_highlightedMovingObjectIdx = std::nullopt;
                         } else {
-                            m_highlightedLineIndices.clear();
+                            clearHighlightedLines();
                             auto movingObject
                                 = movingObjectUnderCursor(window, mousePos.x, mousePos.y);
                             if (movingObject.has_value()) {
                                 m_highlightedMovingObjectIdx = movingObject.value();
                             }
                         }
+                        if (m_highlightedMovingObjectIdx != previousMovingObjectIdx) {
+                            if (previousMovingObjectIdx.has_value()) {
+                                recolourMovingObject(*previousMovingObjectIdx);
+                            }
+                            if (m_highlightedMovingObjectIdx.has_value()) {
+                                recolourMovingObject(*m_highlightedMovingObjectIdx);
+                            }
+                        }
                         break;
                     }
                 case Mode::START:
@@ -963,34 +1201,28 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                             { static_cast<int>(mousePos.x), static_cast<int>(mousePos.y) });
                         // if we're within r workspace units of an existing start object,
                         // we treat additional clicks as a way to modify the object's rotation
-                        unsigned r = 20;
+                        const float r = 20.f;
                         if (m_startPosition.has_value()
                             && ((m_startPosition.value().x > w.x - r
                                  && m_startPosition.value().x < w.x + r)
                                 && (m_startPosition.value().y > w.y - r
                                     && m_startPosition.value().y < w.y + r))) {
-                            m_startPosition.value().r += 15;
-                            if (m_startPosition.value().r >= 360) {
-                                m_startPosition.value().r = 0;
+                            SetStartAction action { m_startPosition, m_startPosition };
+                            action.newPosition->r += 15;
+                            if (action.newPosition->r >= 360) {
+                                action.newPosition->r = 0;
                             }
-                            addReplayItem(
-                                { Mode::START,
-                                  0,
-                                  m_startPosition.value().x,
-                                  m_startPosition.value().y,
-                                  0,
-                                  0,
-                                  m_startPosition.value().r });
-                            m_dirty = true;
+                            applyAction(action);
+                            addReplayItem(std::move(action));
+                            ++m_editGeneration;
                         } else {
-                            m_startPosition
-                                = { static_cast<unsigned>(w.x), static_cast<unsigned>(w.y), 0 };
-                            addReplayItem(
-                                { Mode::START,
-                                  0,
-                                  static_cast<unsigned>(w.x),
-                                  static_cast<unsigned>(w.y) });
-                            m_dirty = true;
+                            SetStartAction action {
+                                m_startPosition,
+                                StartPosition { static_cast<int>(w.x), static_cast<int>(w.y), 0 }
+                            };
+                            applyAction(action);
+                            addReplayItem(std::move(action));
+                            ++m_editGeneration;
                         }
                         break;
                     }
@@ -998,15 +1230,13 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                     {
                         auto w = window.mapPixelToCoords(
                             { static_cast<int>(mousePos.x), static_cast<int>(mousePos.y) });
-                        m_exitPosition = std::make_pair(w.x, w.y);
-                        addReplayItem(
-                            { Mode::EXIT,
-                              0,
-                              static_cast<unsigned>(w.x),
-                              static_cast<unsigned>(w.y),
-                              0,
-                              0 });
-                        m_dirty = true;
+                        SetExitAction action {
+                            m_exitPosition,
+                            std::make_pair(static_cast<int>(w.x), static_cast<int>(w.y))
+                        };
+                        applyAction(action);
+                        addReplayItem(std::move(action));
+                        ++m_editGeneration;
                         break;
                     }
                 case Mode::FUEL:
@@ -1015,28 +1245,29 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                             { static_cast<int>(mousePos.x), static_cast<int>(mousePos.y) });
                         // if we are within r workspace units of an existing fuel object, we
                         // treat this as a request to delete it instead of placing a new one
-                        unsigned r = 20;
+                        const float r = 20.f;
                         std::size_t idx = 0;
                         bool erased { false };
                         for (const auto& f : m_fuelObjects) {
                             if ((f.first > w.x - r && f.first < w.x + r)
                                 && (f.second > w.y - r && f.second < w.y + r)) {
-                                m_fuelObjects.erase(m_fuelObjects.begin() + idx);
+                                RemoveFuelAction action { idx, f };
+                                applyAction(action);
+                                addReplayItem(std::move(action));
                                 erased = true;
-                                addReplayItem({ Mode::FUEL, idx, 0, 0, 0, 0, 0, true });
-                                m_dirty = true;
+                                ++m_editGeneration;
                                 break;
                             }
                             ++idx;
                         }
                         if (!erased) {
-                            m_fuelObjects.push_back(std::make_pair(w.x, w.y));
-                            addReplayItem(
-                                { Mode::FUEL,
-                                  idx,
-                                  static_cast<unsigned>(w.x),
-                                  static_cast<unsigned>(w.y) });
-                            m_dirty = true;
+                            AddFuelAction action {
+                                m_fuelObjects.size(),
+                                std::make_pair(static_cast<int>(w.x), static_cast<int>(w.y))
+                            };
+                            applyAction(action);
+                            addReplayItem(std::move(action));
+                            ++m_editGeneration;
                         }
                         break;
                     }
@@ -1046,25 +1277,25 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                             { static_cast<int>(mousePos.x), static_cast<int>(mousePos.y) });
                         m_currentPolygon.centreX = w.x;
                         m_currentPolygon.centreY = w.y;
-                        std::string s = getInputFromDialog(
-                            window,
-                            m_fixedView,
-                            m_font,
+                        inputbox(
                             "Enter Number of Sides (3-64)",
                             "12",
-                            InputType::numeric);
-                        if (!s.empty()) {
-                            unsigned sides = std::stoi(s);
-                            if (sides < 3) {
-                                sides = 3;
-                            }
-                            if (sides > 64) {
-                                sides = 64;
-                            }
-                            m_currentPolygon.sides = sides;
-                            m_dirty = true;
-                        }
-                        changeMode(Mode::POLYGON_RADIUS);
+                            InputType::numeric,
+                            [this](bool, const std::string& s) {
+                                if (!s.empty()) {
+                                    if (const auto sides = utils::parseFloat(s)) {
+                                        m_currentPolygon.sides
+                                            = static_cast<unsigned>(std::clamp(*sides, 3.f, 64.f));
+                                        ++m_editGeneration;
+                                    } else {
+                                        msgbox(
+                                            "Polygon",
+                                            s + " isn't a number of sides",
+                                            [](bool, const std::string&) { });
+                                    }
+                                }
+                                changeMode(Mode::POLYGON_RADIUS);
+                            });
                         break;
                     }
                 case Mode::POLYGON_RADIUS:
@@ -1076,10 +1307,12 @@ void mgo::Level::processEvent(sf::RenderWindow& window, const sf::Event& event)
                             std::abs(static_cast<float>(w.x) - *m_currentPolygon.centreX),
                             std::abs(static_cast<float>(w.y) - *m_currentPolygon.centreY));
                         if (maxDist > 5.f) { // arbitrary lower limit for polygons' radii
-                            m_lines.insert(
-                                m_lines.end(),
-                                m_currentPolygon.lines.begin(),
-                                m_currentPolygon.lines.end());
+                            AddLinesAction action;
+                            for (const auto& l : m_currentPolygon.lines) {
+                                action.indices.push_back(addLine(l));
+                            }
+                            addReplayItem(std::move(action));
+                            ++m_editGeneration;
                             m_currentPolygon.lines.clear();
                             m_currentPolygon.centreX = std::nullopt;
                             m_currentPolygon.centreY = std::nullopt;
@@ -1117,30 +1350,39 @@ void Level::addOrRemoveHighlightedLine(std::optional<size_t>& lineIdx, bool incl
     if (!lineIdx.has_value()) {
         return;
     }
-    auto i = std::find(m_highlightedLineIndices.begin(), m_highlightedLineIndices.end(), *lineIdx);
-    if (i == m_highlightedLineIndices.end()) {
+    if (!m_highlightedLineIndices.contains(*lineIdx)) {
         if (includeConnectedLines) {
-            addConnectedLinesToHighlight(m_lines[*lineIdx]);
+            addConnectedLinesToHighlight(*lineIdx);
         } else {
-            m_highlightedLineIndices.insert(*lineIdx);
+            highlightLine(*lineIdx);
         }
     } else {
-        m_highlightedLineIndices.erase(i);
+        unhighlightLine(*lineIdx);
         // TODO remove connected lines if includeConnectedLines == true
     }
 }
 
-void Level::addConnectedLinesToHighlight(const Line& line)
+void Level::addConnectedLinesToHighlight(std::size_t lineIdx)
 {
-    for (std::size_t i = 0; i < m_lines.size(); ++i) {
-        if (!m_lines[i].inactive) {
-            if (!m_highlightedLineIndices.contains(i)) {
-                if ((m_lines[i].x0 == line.x0 && m_lines[i].y0 == line.y0)
-                    || (m_lines[i].x1 == line.x1 && m_lines[i].y1 == line.y1)
-                    || (m_lines[i].x0 == line.x1 && m_lines[i].y0 == line.y1)
-                    || (m_lines[i].x1 == line.x0 && m_lines[i].y1 == line.y0)) {
-                    m_highlightedLineIndices.insert(i);
-                    addConnectedLinesToHighlight(m_lines[i]);
+    // Follows shared vertices outwards from the starting line. This is iterative rather
+    // than recursive as wall chains can be many thousands of lines long.
+    std::vector<std::size_t> pending;
+    if (!m_lines.inactive(lineIdx)) {
+        highlightLine(lineIdx);
+        pending.push_back(lineIdx);
+    }
+    while (!pending.empty()) {
+        const Line line = m_lines[pending.back()];
+        pending.pop_back();
+        for (const auto key : { endpointKey(line.x0, line.y0), endpointKey(line.x1, line.y1) }) {
+            auto it = m_lineEndpoints.find(key);
+            if (it == m_lineEndpoints.end()) {
+                continue;
+            }
+            for (const std::size_t i : it->second) {
+                if (!m_highlightedLineIndices.contains(i)) {
+                    highlightLine(i);
+                    pending.push_back(i);
                 }
             }
         }
@@ -1149,29 +1391,404 @@ void Level::addConnectedLinesToHighlight(const Line& line)
 
 void Level::moveMovingObject(std::size_t movingObjectIdx, int x, int y)
 {
-    auto& obj = m_movingObjects[movingObjectIdx];
-    for (auto& line : obj.lines) {
-        line.x0 += x;
-        line.y0 += y;
-        line.x1 += x;
-        line.y1 += y;
-    }
+    MoveMovingObjectAction action { movingObjectIdx, x, y };
+    applyAction(action);
+    addReplayItem(std::move(action));
+    ++m_editGeneration;
 }
 
 void Level::moveLines(int x, int y)
 {
-    for (auto& idx : m_highlightedLineIndices) {
-        m_lines[idx].x0 += x;
-        m_lines[idx].y0 += y;
-        m_lines[idx].x1 += x;
-        m_lines[idx].y1 += y;
+    if (m_highlightedLineIndices.empty()) {
+        return;
+    }
+    MoveLinesAction action { m_highlightedLineIndices.sorted(), x, y };
+    applyAction(action);
+    addReplayItem(std::move(action));
+    ++m_editGeneration;
+}
+
+void Level::deleteLines(std::vector<std::size_t> indices)
+{
+    DeleteLinesAction action { std::move(indices), {} };
+    action.lines.reserve(action.indices.size());
+    for (const std::size_t i : action.indices) {
+        action.lines.push_back(m_lines[i]);
+    }
+    applyAction(action);
+    addReplayItem(std::move(action));
+    ++m_editGeneration;
+}
+
+std::size_t Level::simplifyLines(float tolerance)
+{
+    Simplification simplification = planSimplification(m_lines.toVector(), tolerance);
+    if (simplification.removed.empty()) {
+        return 0;
+    }
+    clearHighlightedLines();
+    SimplifyLinesAction action { std::move(simplification.removed), {}, {} };
+    action.lines.reserve(action.indices.size());
+    for (const std::size_t i : action.indices) {
+        action.lines.push_back(m_lines[i]);
+    }
+    for (const auto& l : simplification.added) {
+        action.replacements.push_back(addLine(l));
+    }
+    for (const std::size_t i : action.indices) {
+        deactivateLine(i);
+    }
+    const std::size_t removed = action.indices.size() - action.replacements.size();
+    addReplayItem(std::move(action));
+    ++m_editGeneration;
+    return removed;
+}
+
+void Level::convertHighlightedLines()
+{
+    if (m_highlightedLineIndices.empty()) {
+        return;
+    }
+    ConvertToMovingObjectAction action {
+        m_highlightedLineIndices.sorted(), {}, m_movingObjects.size(), {}
+    };
+    action.lines.reserve(action.indices.size());
+    for (std::size_t i : action.indices) {
+        action.lines.push_back(m_lines[i]);
+        Line l = m_lines[i];
+        l.r = 255;
+        l.g = 172;
+        l.b = 163;
+        action.object.lines.push_back(l);
+    }
+    clearHighlightedLines();
+    applyAction(action);
+    addReplayItem(std::move(action));
+    ++m_editGeneration;
+}
+
+void Level::setMovingObjectProperty(
+    std::size_t movingObjectIdx,
+    float MovingObject::* property,
+    float value)
+{
+    EditMovingObjectAction action {
+        movingObjectIdx, property, m_movingObjects[movingObjectIdx].*property, value
+    };
+    applyAction(action);
+    addReplayItem(std::move(action));
+}
+
+void Level::editMovingObjectProperty(
+    std::size_t movingObjectIdx,
+    float MovingObject::* property,
+    const std::string& prompt,
+    std::function<void()> next)
+{
+    inputbox(
+        prompt,
+        utils::to_string_with_precision(m_movingObjects[movingObjectIdx].*property, 1),
+        InputType::numeric,
+        [this, movingObjectIdx, property, next](bool, const std::string& s) {
+            if (!s.empty()) {
+                const auto value = utils::parseFloat(s);
+                if (!value.has_value()) {
+                    msgbox(
+                        "Moving Object",
+                        s + " isn't a number",
+                        [next](bool, const std::string&) {
+                            if (next) {
+                                next();
+                            }
+                        });
+                    return;
+                }
+                setMovingObjectProperty(movingObjectIdx, property, *value);
+                ++m_editGeneration;
+            }
+            if (next) {
+                next();
+            }
+        });
+}
+
+void Level::setTitle(const std::string& title)
+{
+    m_levelDescription = title;
+    if (m_window) {
+        m_window->setTitle(m_fileName + " - " + m_levelDescription);
+    }
+}
+
+std::size_t Level::addLine(const Line& line)
+{
+    const std::size_t idx = m_lines.size();
+    m_lines.push_back(line);
+    if (!line.inactive) {
+        m_lineGrid.insert(idx, line);
+        addLineEndpoints(idx);
+        m_lineLod.invalidateLine(idx);
+    } else {
+        ++m_inactiveLineCount;
     }
+    updateLineVertices(idx);
+    return idx;
+}
+
+void Level::reactivateLine(std::size_t idx)
+{
+    if (!m_lines.inactive(idx)) {
+        return;
+    }
+    m_lines.setInactive(idx, false);
+    --m_inactiveLineCount;
+    m_lineGrid.insert(idx, m_lines[idx]);
+    addLineEndpoints(idx);
+    m_lineLod.invalidateLine(idx);
+    updateLineVertices(idx);
+}
+
+void Level::deactivateLine(std::size_t idx)
+{
+    if (m_lines.inactive(idx)) {
+        return;
+    }
+    m_lineLod.invalidateLine(idx);
+    m_lineGrid.remove(idx, m_lines[idx]);
+    removeLineEndpoints(idx);
+    m_lines.setInactive(idx, true);
+    ++m_inactiveLineCount;
+    updateLineVertices(idx);
+}
+
+void Level::translateLine(std::size_t idx, int x, int y)
+{
+    Line l = m_lines[idx];
+    if (!l.inactive) {
+        m_lineLod.invalidateLine(idx);
+        m_lineGrid.remove(idx, l);
+        removeLineEndpoints(idx);
+    }
+    l.x0 += x;
+    l.y0 += y;
+    l.x1 += x;
+    l.y1 += y;
+    m_lines.set(idx, l);
+    if (!l.inactive) {
+        m_lineGrid.insert(idx, l);
+        addLineEndpoints(idx);
+        m_lineLod.invalidateLine(idx);
+    }
+    updateLineVertices(idx);
+}
+
+void Level::resetGeometryCaches()
+{
+    // Used after wholesale changes to the level, e.g. loading
+    m_lineVerticesDirty = true;
+    rebuildLineIndex();
+    invalidateMovingObjects();
+}
+
+void Level::rebuildLineIndex()
+{
+    m_lineGrid.clear();
+    m_lineEndpoints.clear();
+    m_lineLod.invalidateAll();
+    m_inactiveLineCount = 0;
+    for (std::size_t idx = 0; idx < m_lines.size(); ++idx) {
+        if (!m_lines.inactive(idx)) {
+            m_lineGrid.insert(idx, m_lines[idx]);
+            addLineEndpoints(idx);
+        } else {
+            ++m_inactiveLineCount;
+        }
+    }
+}
+
+void Level::compactLinesIfNeeded()
+{
+    // Only worth doing once a reasonable number of new tombstones have built up
+    const std::size_t threshold = std::max(
+        compactionMinimumTombstones,
+        static_cast<std::size_t>(m_lines.size() * compactionTombstoneFraction));
+    if (m_inactiveLineCount > m_inactiveLineCountAfterCompaction + threshold) {
+        compactLines();
+    }
+}
+
+void Level::compactLines()
+{
+    // Removes deactivated lines from m_lines and renumbers everything which refers to
+    // lines by index. Lines removed by an action still in effect (deleted, simplified away or
+    // converted to a moving object) hold their values in that action, so they're dropped and
+    // every reference to them becomes a placeholder id.
+    // Other inactive lines the history refers to (e.g. ones an undone addition would bring
+    // back) have to stay so that they can be reactivated.
+    std::vector<bool> pinned(m_lines.size(), false);
+    forEachHistoryLineIndex(m_replay, [&](std::size_t& i) {
+        if (i < droppedLineIdBase) {
+            pinned[i] = true;
+        }
+    });
+    for (std::size_t n = 0; n < m_replayIndex; ++n) {
+        std::visit(
+            [&](const auto& a) {
+                if constexpr (requires { a.lines; }) {
+                    for (const std::size_t i : a.indices) {
+                        if (i < droppedLineIdBase) {
+                            pinned[i] = false;
+                        }
+                    }
+                }
+            },
+            m_replay[n]);
+    }
+    std::vector<std::size_t> remap(m_lines.size());
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < m_lines.size(); ++i) {
+        if (!m_lines.inactive(i) || pinned[i]) {
+            remap[i] = kept;
+            m_lines.set(kept, m_lines[i]);
+            ++kept;
+        } else {
+            remap[i] = m_nextDroppedLineId++;
+        }
+    }
+    m_lines.resize(kept);
+    forEachHistoryLineIndex(m_replay, [&](std::size_t& i) {
+        if (i < droppedLineIdBase) {
+            i = remap[i];
+        }
+    });
+    LineSelection highlighted;
+    for (const std::size_t i : m_highlightedLineIndices.indices()) {
+        if (remap[i] < droppedLineIdBase) {
+            highlighted.insert(remap[i]);
+        }
+    }
+    m_highlightedLineIndices = std::move(highlighted);
+    m_lineVerticesDirty = true;
+    rebuildLineIndex();
+    m_inactiveLineCountAfterCompaction = m_inactiveLineCount;
+}
+
+void Level::restoreDroppedLines(Action& action)
+{
+    std::unordered_map<std::size_t, std::size_t> restored;
+    std::visit(
+        [&](const auto& a) {
+            if constexpr (requires { a.lines; }) {
+                for (std::size_t n = 0; n < a.indices.size(); ++n) {
+                    if (a.indices[n] >= droppedLineIdBase) {
+                        Line l = a.lines[n];
+                        l.inactive = true; // undoing the action reactivates it
+                        restored.emplace(a.indices[n], addLine(l));
+                    }
+                }
+            }
+        },
+        action);
+    if (restored.empty()) {
+        return;
+    }
+    forEachHistoryLineIndex(m_replay, [&](std::size_t& i) {
+        if (const auto it = restored.find(i); it != restored.end()) {
+            i = it->second;
+        }
+    });
+}
+
+void Level::addLineEndpoints(std::size_t idx)
+{
+    const Line l = m_lines[idx];
+    m_lineEndpoints[endpointKey(l.x0, l.y0)].push_back(idx);
+    m_lineEndpoints[endpointKey(l.x1, l.y1)].push_back(idx);
+}
+
+void Level::removeLineEndpoints(std::size_t idx)
+{
+    const Line l = m_lines[idx];
+    for (const auto key : { endpointKey(l.x0, l.y0), endpointKey(l.x1, l.y1) }) {
+        auto it = m_lineEndpoints.find(key);
+        if (it == m_lineEndpoints.end()) {
+            continue;
+        }
+        auto& lines = it->second;
+        auto found = std::find(lines.begin(), lines.end(), idx);
+        if (found != lines.end()) {
+            *found = lines.back();
+            lines.pop_back();
+        }
+        if (lines.empty()) {
+            m_lineEndpoints.erase(it);
+        }
+    }
+}
+
+const std::vector<std::size_t>* Level::linesAt(int x, int y) const
+{
+    auto it = m_lineEndpoints.find(endpointKey(x, y));
+    return it == m_lineEndpoints.end() ? nullptr : &it->second;
+}
+
+void Level::invalidateMovingObjects()
+{
+    m_movingObjectShapes.assign(m_movingObjects.size(), std::nullopt);
+    m_movingObjectVerticesDirty = true;
+    m_movingObjectGridDirty = true;
+}
+
+void Level::invalidateMovingObject(std::size_t idx)
+{
+    m_movingObjectShapes[idx].reset();
+    m_movingObjectVerticesDirty = true;
+    m_movingObjectGridDirty = true;
+}
+
+void Level::insertMovingObject(std::size_t idx, const MovingObject& object)
+{
+    m_movingObjects.insert(m_movingObjects.begin() + idx, object);
+    m_movingObjectShapes.insert(m_movingObjectShapes.begin() + idx, std::nullopt);
+    m_movingObjectVerticesDirty = true;
+    m_movingObjectGridDirty = true;
+}
+
+void Level::eraseMovingObject(std::size_t idx)
+{
+    m_movingObjects.erase(m_movingObjects.begin() + idx);
+    m_movingObjectShapes.erase(m_movingObjectShapes.begin() + idx);
+    m_movingObjectVerticesDirty = true;
+    m_movingObjectGridDirty = true;
+}
+
+void Level::rebuildMovingObjectGrid()
+{
+    // Moving objects are few and are edited as whole objects, so the index for them is
+    // simply regenerated lazily whenever any of them change
+    m_movingObjectGrid.clear();
+    m_movingObjectLineRefs.clear();
+    for (std::size_t obj = 0; obj < m_movingObjects.size(); ++obj) {
+        const auto& lines = m_movingObjects[obj].lines;
+        for (std::size_t line = 0; line < lines.size(); ++line) {
+            if (!lines[line].inactive) {
+                m_movingObjectGrid.insert(m_movingObjectLineRefs.size(), lines[line]);
+                m_movingObjectLineRefs.emplace_back(obj, line);
+            }
+        }
+    }
+    m_movingObjectGridDirty = false;
 }
 
 void Level::quit(sf::RenderWindow& window)
 {
     std::string msg = "Are you sure?";
-    if (m_dirty) {
+    if (isSaving()) {
+        // Quitting waits for the save to finish
+        msg = m_editGeneration != m_savingGeneration
+            ? "A save is in progress, but changes since it started are UNSAVED! Are you sure?"
+            : "A save is still in progress, and will finish first. Are you sure?";
+    } else if (m_editGeneration != m_savedGeneration) {
         msg = "File has UNSAVED CHANGES! Are you sure?";
     }
     msgbox("Quit", msg, [&window](bool yes, const std::string) {
@@ -1183,7 +1800,10 @@ void Level::quit(sf::RenderWindow& window)
 
 void Level::zoomOut()
 {
-    if (m_view.getSize().x < 2400.f) {
+    // Out to a little beyond the whole of the workspace
+    const sf::FloatRect workspace = workspaceBounds();
+    if (m_view.getSize().x < std::max(2400.f, workspace.size.x * 1.2f)
+        || m_view.getSize().y < workspace.size.y * 1.2f) {
         m_view.zoom(1.05f);
         m_viewZoomLevel *= 1.05f;
     }
@@ -1218,11 +1838,35 @@ bool mgo::Level::msgbox(
     m_dialogText.setString(message + "\n\nEnter for OK, Esc for Cancel");
     m_dialogText.setPosition({ 40.f, 70.f });
     m_dialogCallback = callback;
+    m_dialogInput.reset();
+    m_dialogKeyPressed = false;
     return false;
 }
 
-void mgo::Level::drawModes(sf::RenderWindow& window)
+void mgo::Level::inputbox(
+    const std::string& prompt,
+    const std::string& defaultEntry,
+    InputType inputType,
+    std::function<void(bool, const std::string&)> callback)
+{
+    msgbox(prompt, "", callback);
+    m_dialogText.setString("Enter for OK, Esc for Cancel");
+    m_dialogText.setPosition({ 40.f, 115.f });
+    m_dialogInputBox.setSize(sf::Vector2f(560, 32));
+    m_dialogInputBox.setFillColor(sf::Color::White);
+    m_dialogInputBox.setOutlineColor(sf::Color::Red);
+    m_dialogInputBox.setOutlineThickness(2);
+    m_dialogInputBox.setPosition({ 40.f, 70.f });
+    m_dialogInputText.setCharacterSize(20);
+    m_dialogInputText.setFillColor(sf::Color::Black);
+    m_dialogInputText.setPosition({ 45.f, 73.f });
+    m_dialogInput.emplace(defaultEntry, inputType);
+    m_dialogInputText.setString(defaultEntry + "_");
+}
+
+void mgo::Level::drawModes(sf::RenderTarget& window)
 {
+    PROFILE_PHASE(MODES);
     // Main insertion mode:
     sf::Text txtMode(m_font);
     txtMode.setFillColor(sf::Color::Cyan);
@@ -1258,6 +1902,7 @@ void mgo::Level::drawModes(sf::RenderWindow& window)
             break;
     }
     window.draw(txtMode);
+    PROFILE_DRAW_CALL(textVertexCount(txtMode));
 
     // Snapping mode:
     sf::Text txtSnap(m_font);
@@ -1281,62 +1926,99 @@ void mgo::Level::drawModes(sf::RenderWindow& window)
             break;
     }
     window.draw(txtSnap);
+    PROFILE_DRAW_CALL(textVertexCount(txtSnap));
 }
 
-void mgo::Level::highlightGridVertex(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY)
+void mgo::Level::highlightGridVertex(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY)
 {
     const auto w = window.mapPixelToCoords({ static_cast<int>(mouseX), static_cast<int>(mouseY) });
 
-    const unsigned x = static_cast<unsigned>(static_cast<double>(w.x) / 50.0 + 0.5) * 50.0;
-    const unsigned y = static_cast<unsigned>(static_cast<double>(w.y) / 50.0 + 0.5) * 50.0;
-    if (x > 2000 || y > 2000) {
+    const int x = static_cast<int>(std::lround(w.x / gridSpacing)) * gridSpacing;
+    const int y = static_cast<int>(std::lround(w.y / gridSpacing)) * gridSpacing;
+    const sf::FloatRect workspace = workspaceBounds();
+    if (x < workspace.position.x - gridSpacing || y < workspace.position.y - gridSpacing
+        || x > workspace.position.x + workspace.size.x + gridSpacing
+        || y > workspace.position.y + workspace.size.y + gridSpacing) {
         m_currentNearestSnapPoint = std::nullopt;
     } else {
         m_currentNearestSnapPoint = std::tie(x, y);
     }
 }
 
-void Level::highlightNearestLinePoint(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY)
+void Level::highlightNearestLinePoint(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY)
 {
+    // Finds the closest point on any line (static or moving) within snapping distance of
+    // the cursor. Only the lines in the grid cells around the cursor are considered.
+    constexpr int snapDistance = 5;
     const auto w = window.mapPixelToCoords({ static_cast<int>(mouseX), static_cast<int>(mouseY) });
-    for (const auto& l : m_lines) {
-        if (l.inactive) {
-            continue;
-        }
-        auto nearest = utils::closestPointOnLine(l.x0, l.y0, l.x1, l.y1, w.x, w.y, 5);
-        if (nearest.has_value()) {
-            m_currentNearestSnapPoint = std::tie(nearest.value().first, nearest.value().second);
-            return;
+    // The candidates are gathered into a batch and tested together
+    m_segmentBatch.clear();
+    m_lineGrid.query(
+        w.x - snapDistance,
+        w.y - snapDistance,
+        w.x + snapDistance,
+        w.y + snapDistance,
+        m_gridQueryResults);
+    for (const std::size_t idx : m_gridQueryResults) {
+        if (!m_lines.inactive(idx)) {
+            m_segmentBatch.push_back(m_lines[idx]);
         }
     }
-    for (const auto& m : m_movingObjects) {
-        for (const auto& l : m.lines) {
-            if (l.inactive) {
-                continue;
-            }
-            auto nearest = utils::closestPointOnLine(l.x0, l.y0, l.x1, l.y1, w.x, w.y, 5);
-            if (nearest.has_value()) {
-                m_currentNearestSnapPoint = std::tie(nearest.value().first, nearest.value().second);
-                return;
-            }
+    if (m_movingObjectGridDirty) {
+        rebuildMovingObjectGrid();
+    }
+    m_movingObjectGrid.query(
+        w.x - snapDistance,
+        w.y - snapDistance,
+        w.x + snapDistance,
+        w.y + snapDistance,
+        m_gridQueryResults);
+    for (const std::size_t ref : m_gridQueryResults) {
+        const auto [obj, line] = m_movingObjectLineRefs[ref];
+        const Line& l = m_movingObjects[obj].lines[line];
+        if (!l.inactive) {
+            m_segmentBatch.push_back(l);
         }
     }
-    // Also check moving object in progress
+    // Also check moving object in progress (this isn't indexed as it only ever has a
+    // handful of lines)
     for (const auto& l : m_currentMovingObject.lines) {
-        if (l.inactive) {
+        if (!l.inactive) {
+            m_segmentBatch.push_back(l);
+        }
+    }
+    m_segmentBatch.closestPoints(
+        static_cast<int>(w.x), static_cast<int>(w.y), snapDistance, m_nearestPoints);
+    std::optional<std::pair<int, int>> best;
+    double bestDistanceSquared { 0.0 };
+    for (std::size_t i = 0; i < m_segmentBatch.size(); ++i) {
+        if (!m_nearestPoints.within[i]) {
             continue;
         }
-        auto nearest = utils::closestPointOnLine(l.x0, l.y0, l.x1, l.y1, w.x, w.y, 5);
-        if (nearest.has_value()) {
-            m_currentNearestSnapPoint = std::tie(nearest.value().first, nearest.value().second);
-            return;
+        const double dx = static_cast<double>(m_nearestPoints.x[i]) - w.x;
+        const double dy = static_cast<double>(m_nearestPoints.y[i]) - w.y;
+        const double distanceSquared = dx * dx + dy * dy;
+        if (!best.has_value() || distanceSquared < bestDistanceSquared) {
+            best = { m_nearestPoints.x[i], m_nearestPoints.y[i] };
+            bestDistanceSquared = distanceSquared;
         }
     }
+    if (best.has_value()) {
+        m_currentNearestSnapPoint = std::tie(best->first, best->second);
+    }
 }
 
-void Level::drawObjects(sf::RenderWindow& window)
+void Level::drawObjects(sf::RenderTarget& window)
 {
-    if (m_startPosition.has_value()) {
+    PROFILE_PHASE(OBJECTS);
+    // Grown by the size of the largest object, so anything partly in view is drawn
+    sf::FloatRect visible = visibleArea(window.getView());
+    visible.position -= sf::Vector2f(50.f, 50.f);
+    visible.size += sf::Vector2f(100.f, 100.f);
+    auto inView = [&](int x, int y) {
+        return visible.contains({ static_cast<float>(x), static_cast<float>(y) });
+    };
+    if (m_startPosition.has_value() && inView(m_startPosition->x, m_startPosition->y)) {
         sf::ConvexShape ship;
         ship.setPointCount(3);
         // define the points
@@ -1349,8 +2031,9 @@ void Level::drawObjects(sf::RenderWindow& window)
               static_cast<float>(m_startPosition.value().y) });
         ship.setRotation(sf::degrees(360.f - m_startPosition.value().r));
         window.draw(ship);
+        PROFILE_DRAW_CALL(ship.getPointCount());
     }
-    if (m_exitPosition.has_value()) {
+    if (m_exitPosition.has_value() && inView(m_exitPosition->first, m_exitPosition->second)) {
         sf::Text exit(m_font);
         exit.setCharacterSize(26.f);
         exit.setString("EXIT");
@@ -1361,9 +2044,13 @@ void Level::drawObjects(sf::RenderWindow& window)
             { static_cast<float>(m_exitPosition.value().first),
               static_cast<float>(m_exitPosition.value().second) });
         window.draw(exit);
+        PROFILE_DRAW_CALL(textVertexCount(exit));
     }
     if (!m_fuelObjects.empty()) {
         for (const auto& p : m_fuelObjects) {
+            if (!inView(p.first, p.second)) {
+                continue;
+            }
             sf::CircleShape c;
             c.setFillColor(sf::Color::Yellow);
             float r = 10.f;
@@ -1371,10 +2058,31 @@ void Level::drawObjects(sf::RenderWindow& window)
             c.setOrigin({ r, r });
             c.setPosition({ static_cast<float>(p.first), static_cast<float>(p.second) });
             window.draw(c);
+            PROFILE_DRAW_CALL(c.getPointCount());
         }
     }
 }
 
+bool Level::needsRedraw() const
+{
+    return m_needsRedraw;
+}
+
+void Level::requestRedraw()
+{
+    m_needsRedraw = true;
+}
+
+void Level::clearNeedsRedraw()
+{
+    m_needsRedraw = false;
+}
+
+const sf::Font& Level::getFont() const
+{
+    return m_font;
+}
+
 sf::View& Level::getView()
 {
     return m_view;
@@ -1387,138 +2095,234 @@ sf::View& Level::getFixedView()
 
 void Level::clampViewport()
 {
-    const float mapWidth = 2000.f;
-    const float mapHeight = 2000.f;
+    const sf::FloatRect workspace = workspaceBounds();
+    const sf::Vector2f workspaceMin = workspace.position;
+    const sf::Vector2f workspaceMax = workspace.position + workspace.size;
 
     sf::Vector2f viewCentre = m_view.getCenter();
 
     // Calculate half the view size (what's visible on screen)
     sf::Vector2f halfSize = m_view.getSize() / 2.f;
 
-    viewCentre.x = std::max(halfSize.x, std::min(viewCentre.x, mapWidth - halfSize.x));
-    viewCentre.y = std::max(halfSize.y, std::min(viewCentre.y, mapHeight - halfSize.y));
+    viewCentre.x = std::max(
+        workspaceMin.x + halfSize.x, std::min(viewCentre.x, workspaceMax.x - halfSize.x));
+    viewCentre.y = std::max(
+        workspaceMin.y + halfSize.y, std::min(viewCentre.y, workspaceMax.y - halfSize.y));
 
-    // If the view is larger than the map in either dimension, centre it
-    if (m_view.getSize().x > mapWidth) {
-        viewCentre.x = mapWidth / 2.f;
+    // If the view is larger than the workspace in either dimension, centre it
+    if (m_view.getSize().x > workspace.size.x) {
+        viewCentre.x = workspaceMin.x + workspace.size.x / 2.f;
     }
-    if (m_view.getSize().y > mapHeight) {
-        viewCentre.y = mapHeight / 2.f;
+    if (m_view.getSize().y > workspace.size.y) {
+        viewCentre.y = workspaceMin.y + workspace.size.y / 2.f;
     }
     m_view.setCenter(viewCentre);
 }
 
-void Level::revert()
+void Level::undo()
 {
-    // Revert to last saved state
-    // Clear collections:
-    m_lines.clear();
-    m_startPosition = std::nullopt;
-    m_exitPosition = std::nullopt;
-    m_fuelObjects.clear();
-    m_movingObjects.clear();
-    // reload
-    load(m_fileName);
-    m_dirty = false;
+    m_currentInsertionLine.inactive = true;
+    if (m_replayIndex == 0) {
+        return;
+    }
+    --m_replayIndex;
+    restoreDroppedLines(m_replay[m_replayIndex]);
+    revertAction(m_replay[m_replayIndex]);
+    pruneSelection();
+    ++m_editGeneration;
 }
 
-void Level::undo()
+void Level::redo()
 {
-    // The way undo works is to revert to the last save, then reapply all steps held in
-    // m_replay. This will allow for redo as well.
     m_currentInsertionLine.inactive = true;
-    revert();
-    replay();
-    if (m_replayIndex >= 0) {
-        --m_replayIndex; // can go to -1
+    if (m_replayIndex >= m_replay.size()) {
+        return;
     }
+    applyAction(m_replay[m_replayIndex]);
+    ++m_replayIndex;
+    pruneSelection();
+    ++m_editGeneration;
 }
 
-void Level::replay()
+void Level::pruneSelection()
 {
-    for (long i = 0; i < m_replayIndex; ++i) {
-        if (i > static_cast<long>(m_replay.size()) - 1) {
-            break;
+    // Drop anything from the selection which no longer exists after an undo or redo
+    m_highlightedLineIndices.eraseIf([&](std::size_t i) { return m_lines.inactive(i); });
+    m_selectionVerticesDirty = true;
+    if (m_highlightedMovingObjectIdx.has_value()
+        && m_highlightedMovingObjectIdx.value() >= m_movingObjects.size()) {
+        m_highlightedMovingObjectIdx = std::nullopt;
+        m_movingObjectVerticesDirty = true;
+    }
+}
+
+void Level::addReplayItem(Action action)
+{
+    // Anything which had been undone can no longer be redone
+    m_replay.erase(m_replay.begin() + m_replayIndex, m_replay.end());
+    // Runs of nudges of the same selection are coalesced into a single step
+    if (!m_replay.empty()) {
+        auto* lastLineMove = std::get_if<MoveLinesAction>(&m_replay.back());
+        auto* lineMove = std::get_if<MoveLinesAction>(&action);
+        if (lastLineMove && lineMove && lastLineMove->indices == lineMove->indices) {
+            lastLineMove->x += lineMove->x;
+            lastLineMove->y += lineMove->y;
+            return;
         }
-        const auto& a = m_replay[i];
-        switch (a.actionType) {
-            case Mode::LINE:
-                {
-                    Line line;
-                    line.breakable = false;
-                    line.x0 = a.x0;
-                    line.y0 = a.y0;
-                    line.x1 = a.x1;
-                    line.y1 = a.y1;
-                    line.r = 255;
-                    m_lines.push_back(line);
-                }
-                break;
-            case Mode::BREAKABLE:
-                {
-                    Line line;
-                    line.breakable = true;
-                    line.x0 = a.x0;
-                    line.y0 = a.y0;
-                    line.x1 = a.x1;
-                    line.y1 = a.y1;
-                    m_lines.push_back(line);
-                }
-                break;
-            case Mode::EDIT:
-                m_lines[a.index].inactive = true;
-                break;
-            case Mode::EXIT:
-                m_exitPosition = std::make_pair(a.x0, a.y0);
-                break;
-            case Mode::START:
-                m_startPosition = { a.x0, a.y0, a.rotation };
-                break;
-            case Mode::FUEL:
-                if (a.erased) {
-                    m_fuelObjects.erase(m_fuelObjects.begin() + a.index);
-                } else {
-                    m_fuelObjects.push_back(std::make_pair(a.x0, a.y0));
-                }
-                break;
-            case Mode::MOVING:
-                {
-                    Line l;
-                    l.x0 = a.x0;
-                    l.y0 = a.y0;
-                    l.x1 = a.x1;
-                    l.y1 = a.y1;
-                    l.r = 255;
-                    l.g = 172;
-                    l.b = 163;
-                    m_currentMovingObject.lines.push_back(l);
-                }
-                break;
-            default:
-                std::cout << "Unknown action type in replay: " << static_cast<int>(a.actionType)
-                          << std::endl;
-                assert(false);
+        auto* lastObjectMove = std::get_if<MoveMovingObjectAction>(&m_replay.back());
+        auto* objectMove = std::get_if<MoveMovingObjectAction>(&action);
+        if (lastObjectMove && objectMove
+            && lastObjectMove->objectIndex == objectMove->objectIndex) {
+            lastObjectMove->x += objectMove->x;
+            lastObjectMove->y += objectMove->y;
+            return;
         }
     }
+    m_replay.push_back(std::move(action));
+    m_replayIndex = m_replay.size();
 }
 
-void Level::redo()
+void Level::applyAction(const Action& action)
 {
-    if (m_replay.empty() || m_replayIndex >= static_cast<long>(m_replay.size())) {
-        return;
-    }
-    m_replayIndex += 2;
-    replay();
+    std::visit(
+        Overloaded {
+            [&](const AddLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    reactivateLine(i);
+                }
+            },
+            [&](const DeleteLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    deactivateLine(i);
+                }
+            },
+            [&](const MoveLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    translateLine(i, a.x, a.y);
+                }
+            },
+            [&](const SimplifyLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    deactivateLine(i);
+                }
+                for (const std::size_t i : a.replacements) {
+                    reactivateLine(i);
+                }
+            },
+            [&](const ConvertToMovingObjectAction& a) {
+                for (const std::size_t i : a.indices) {
+                    deactivateLine(i);
+                }
+                insertMovingObject(a.objectIndex, a.object);
+            },
+            [&](const AddMovingObjectLineAction& a) {
+                m_currentMovingObject.lines.push_back(a.line);
+            },
+            [&](const FinishMovingObjectAction& a) {
+                insertMovingObject(a.objectIndex, a.object);
+                m_currentMovingObject = {};
+            },
+            [&](const DeleteMovingObjectAction& a) {
+                eraseMovingObject(a.objectIndex);
+            },
+            [&](const MoveMovingObjectAction& a) {
+                for (auto& line : m_movingObjects[a.objectIndex].lines) {
+                    line.x0 += a.x;
+                    line.y0 += a.y;
+                    line.x1 += a.x;
+                    line.y1 += a.y;
+                }
+                invalidateMovingObject(a.objectIndex);
+            },
+            [&](const EditMovingObjectAction& a) {
+                m_movingObjects[a.objectIndex].*a.property = a.newValue;
+                invalidateMovingObject(a.objectIndex);
+            },
+            [&](const SetStartAction& a) { m_startPosition = a.newPosition; },
+            [&](const SetExitAction& a) { m_exitPosition = a.newPosition; },
+            [&](const AddFuelAction& a) {
+                m_fuelObjects.insert(m_fuelObjects.begin() + a.index, a.position);
+            },
+            [&](const RemoveFuelAction& a) {
+                m_fuelObjects.erase(m_fuelObjects.begin() + a.index);
+            },
+            [&](const SetTitleAction& a) { setTitle(a.newTitle); } },
+        action);
 }
 
-void Level::addReplayItem(const Action& action)
+void Level::revertAction(const Action& action)
 {
-    std::size_t from = 1 + (m_replayIndex > 0 ? m_replayIndex : 0);
-    if (from < m_replay.size()) {
-        m_replay.erase(m_replay.begin() + from, m_replay.end());
-    }
-    m_replay.push_back(action);
-    m_replayIndex = m_replay.size() - 1;
+    std::visit(
+        Overloaded {
+            [&](const AddLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    unhighlightLine(i);
+                    deactivateLine(i);
+                }
+            },
+            [&](const DeleteLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    reactivateLine(i);
+                }
+            },
+            [&](const MoveLinesAction& a) {
+                for (const std::size_t i : a.indices) {
+                    translateLine(i, -a.x, -a.y);
+                }
+            },
+            [&](const SimplifyLinesAction& a) {
+                for (const std::size_t i : a.replacements) {
+                    unhighlightLine(i);
+                    deactivateLine(i);
+                }
+                for (const std::size_t i : a.indices) {
+                    reactivateLine(i);
+                }
+            },
+            [&](const ConvertToMovingObjectAction& a) {
+                eraseMovingObject(a.objectIndex);
+                for (const std::size_t i : a.indices) {
+                    reactivateLine(i);
+                }
+                m_highlightedMovingObjectIdx = std::nullopt;
+            },
+            [&](const AddMovingObjectLineAction&) {
+                if (!m_currentMovingObject.lines.empty()) {
+                    m_currentMovingObject.lines.pop_back();
+                }
+            },
+            [&](const FinishMovingObjectAction& a) {
+                eraseMovingObject(a.objectIndex);
+                m_currentMovingObject = a.object;
+                m_highlightedMovingObjectIdx = std::nullopt;
+            },
+            [&](const DeleteMovingObjectAction& a) {
+                insertMovingObject(a.objectIndex, a.object);
+                m_highlightedMovingObjectIdx = std::nullopt;
+            },
+            [&](const MoveMovingObjectAction& a) {
+                for (auto& line : m_movingObjects[a.objectIndex].lines) {
+                    line.x0 -= a.x;
+                    line.y0 -= a.y;
+                    line.x1 -= a.x;
+                    line.y1 -= a.y;
+                }
+                invalidateMovingObject(a.objectIndex);
+            },
+            [&](const EditMovingObjectAction& a) {
+                m_movingObjects[a.objectIndex].*a.property = a.oldValue;
+                invalidateMovingObject(a.objectIndex);
+            },
+            [&](const SetStartAction& a) { m_startPosition = a.oldPosition; },
+            [&](const SetExitAction& a) { m_exitPosition = a.oldPosition; },
+            [&](const AddFuelAction& a) {
+                m_fuelObjects.erase(m_fuelObjects.begin() + a.index);
+            },
+            [&](const RemoveFuelAction& a) {
+                m_fuelObjects.insert(m_fuelObjects.begin() + a.index, a.position);
+            },
+            [&](const SetTitleAction& a) { setTitle(a.oldTitle); } },
+        action);
 }
 
 void Level::finishCurrentMovingObject()
@@ -1526,7 +2330,9 @@ void Level::finishCurrentMovingObject()
     if (m_currentMode == Mode::MOVING) {
         // Write any existing  moving object and start a new one
         if (!m_currentMovingObject.lines.empty()) {
-            m_movingObjects.push_back(m_currentMovingObject);
+            FinishMovingObjectAction action { m_movingObjects.size(), m_currentMovingObject };
+            applyAction(action);
+            addReplayItem(std::move(action));
         }
         m_currentMovingObject = {};
     }
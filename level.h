@@ -1,11 +1,24 @@
 #pragma once
+#include "dialog.h"
+#include "linechunks.h"
+#include "linelod.h"
+#include "linestore.h"
+#include "segmentbatch.h"
+#include "selection.h"
+#include "spatialgrid.h"
+#include "tilecache.h"
+
 #include <SFML/Graphics.hpp>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <future>
+#include <limits>
 #include <memory>
 #include <optional>
-#include <set>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -33,33 +46,23 @@ enum class SnapMode {
 
 namespace mgo {
 
-struct Action {
-    Mode actionType;
-    std::size_t index;
-    unsigned x0 { 0 };
-    unsigned y0 { 0 };
-    unsigned x1 { 0 };
-    unsigned y1 { 0 };
-    unsigned rotation { 0 };
-    bool erased { false };
-};
-
+// World coordinates are signed and unbounded; the visible workspace grows with the content
 struct Line {
-    unsigned x0;
-    unsigned y0;
-    unsigned x1;
-    unsigned y1;
+    int x0;
+    int y0;
+    int x1;
+    int y1;
     uint8_t r { 0 };
     uint8_t g { 0 };
     uint8_t b { 0 };
     uint8_t thickness { 1 }; // unused currently
-    bool inactive { false }; // lines don't get deleted, just deactivated, avoids index invalidation
+    bool inactive { false }; // deleted lines are deactivated, and only removed by compaction
     bool breakable { false };
 };
 
 struct StartPosition {
-    unsigned x;
-    unsigned y;
+    int x;
+    int y;
     unsigned r;
 };
 
@@ -80,16 +83,138 @@ struct CurrentPolygon {
     std::vector<Line> lines {};
 };
 
+// Undo / redo actions. Each one holds enough state to be applied or reversed in place, so
+// stepping through the history never needs to reload or replay the level.
+// Line indices refer to m_lines: lines are never removed from there by an action, only
+// deactivated, so the indices stay valid however far back the history is wound. The one
+// exception is lines which an action in effect has removed (by deleting, simplifying or
+// converting them), which compaction drops; their indices become placeholders
+// (droppedLineIdBase and above) until undoing the action brings them back from its lines.
+constexpr std::size_t droppedLineIdBase = std::numeric_limits<std::size_t>::max() / 2;
+
+struct AddLinesAction {
+    std::vector<std::size_t> indices;
+};
+
+struct DeleteLinesAction {
+    std::vector<std::size_t> indices;
+    std::vector<Line> lines; // as deleted, to re-add any which have since been compacted away
+};
+
+struct MoveLinesAction {
+    std::vector<std::size_t> indices;
+    int x { 0 };
+    int y { 0 };
+};
+
+struct SimplifyLinesAction {
+    std::vector<std::size_t> indices; // the lines removed
+    std::vector<Line> lines; // as removed, to re-add any which have since been compacted away
+    std::vector<std::size_t> replacements; // the merged lines added in their place
+};
+
+struct ConvertToMovingObjectAction {
+    std::vector<std::size_t> indices; // the static lines which became the object
+    std::vector<Line> lines; // as converted, to re-add any which have since been compacted away
+    std::size_t objectIndex;
+    MovingObject object;
+};
+
+struct AddMovingObjectLineAction {
+    Line line; // appended to the moving object currently being drawn
+};
+
+struct FinishMovingObjectAction {
+    std::size_t objectIndex;
+    MovingObject object;
+};
+
+struct DeleteMovingObjectAction {
+    std::size_t objectIndex;
+    MovingObject object;
+};
+
+struct MoveMovingObjectAction {
+    std::size_t objectIndex;
+    int x { 0 };
+    int y { 0 };
+};
+
+struct EditMovingObjectAction {
+    std::size_t objectIndex;
+    float MovingObject::* property;
+    float oldValue;
+    float newValue;
+};
+
+struct SetStartAction {
+    std::optional<StartPosition> oldPosition;
+    std::optional<StartPosition> newPosition;
+};
+
+struct SetExitAction {
+    std::optional<std::pair<int, int>> oldPosition;
+    std::optional<std::pair<int, int>> newPosition;
+};
+
+struct AddFuelAction {
+    std::size_t index;
+    std::pair<int, int> position;
+};
+
+struct RemoveFuelAction {
+    std::size_t index;
+    std::pair<int, int> position;
+};
+
+struct SetTitleAction {
+    std::string oldTitle;
+    std::string newTitle;
+};
+
+using Action = std::variant<
+    AddLinesAction,
+    DeleteLinesAction,
+    MoveLinesAction,
+    SimplifyLinesAction,
+    ConvertToMovingObjectAction,
+    AddMovingObjectLineAction,
+    FinishMovingObjectAction,
+    DeleteMovingObjectAction,
+    MoveMovingObjectAction,
+    EditMovingObjectAction,
+    SetStartAction,
+    SetExitAction,
+    AddFuelAction,
+    RemoveFuelAction,
+    SetTitleAction>;
+
+struct LevelData;
+
+class LevelBenchmark;
+
 class Level {
+    friend class LevelBenchmark;
+
 public:
     Level(sf::Window& window, unsigned windowWidth, unsigned windowHeight);
+    // Without a window, for drawing to an offscreen target (e.g. benchmarking)
+    Level(unsigned windowWidth, unsigned windowHeight);
     void load(const std::string& filename);
+    // Asks for confirmation, then writes a snapshot of the level on a background thread so
+    // that editing can carry on meanwhile
     void save();
-    void draw(sf::RenderWindow& window);
-    void drawMovingObjectBoundary(const mgo::MovingObject& m, size_t idx, sf::RenderWindow& window);
-    void drawCircle(float maxRadius, float centreX, float centreY, sf::RenderWindow& window);
-    void drawRoundedRect(
-        sf::RenderWindow& window,
+    bool isSaving() const { return m_backgroundSave.valid(); }
+    // Reports the result of a background save if it has finished; called from the main loop
+    void pollBackgroundSave();
+    // Returns false if the save failed (having reported why)
+    bool waitForBackgroundSave();
+    // Snapshot of the level as it would be saved, including any moving object in progress
+    LevelData levelData() const;
+    void draw(sf::RenderTarget& window);
+    void appendCircle(sf::VertexArray& vertices, float maxRadius, float centreX, float centreY);
+    void appendRoundedRect(
+        sf::VertexArray& vertices,
         float x,
         float y,
         float w,
@@ -98,16 +223,19 @@ public:
         uint8_t red,
         uint8_t green,
         uint8_t blue);
-    void drawDialog(sf::RenderWindow& window);
-    void drawLine(sf::RenderWindow& window, const Line& line, std::optional<std::size_t> idx = std::nullopt);
-    void drawGridLines(sf::RenderWindow& window);
+    void drawDialog(sf::RenderTarget& window);
+    void drawGridLines(sf::RenderTarget& window);
     // Returns the index (into m_Lines) of the first (of potentially several) lines that are *near*
     // the cursor or no value if no lines are nearby.
     std::optional<std::size_t>
-    lineUnderCursor(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY);
+    lineUnderCursor(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY);
     std::optional<std::size_t>
-    movingObjectUnderCursor(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY);
+    movingObjectUnderCursor(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY);
     void processEvent(sf::RenderWindow& window, const sf::Event& event);
+    // Whether anything visible has changed since the last frame was drawn
+    bool needsRedraw() const;
+    void requestRedraw();
+    void clearNeedsRedraw();
     void quit(sf::RenderWindow& window);
     void zoomOut();
     void zoomIn();
@@ -115,46 +243,162 @@ public:
         const std::string& title,
         const std::string& message,
         std::function<void(bool, const std::string&)> callback);
-    void drawModes(sf::RenderWindow& window);
-    void highlightGridVertex(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY);
-    void highlightNearestLinePoint(sf::RenderWindow& window, unsigned mouseX, unsigned mouseY);
-    void drawObjects(sf::RenderWindow& window);
+    // As msgbox, with a line of text to enter which is passed to the callback
+    void inputbox(
+        const std::string& prompt,
+        const std::string& defaultEntry,
+        InputType inputType,
+        std::function<void(bool, const std::string&)> callback);
+    void drawModes(sf::RenderTarget& window);
+    void highlightGridVertex(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY);
+    void highlightNearestLinePoint(sf::RenderTarget& window, unsigned mouseX, unsigned mouseY);
+    void drawObjects(sf::RenderTarget& window);
+    const sf::Font& getFont() const;
     sf::View& getView();
     sf::View& getFixedView();
     void clampViewport();
-    void revert();
+    // The area the grid covers and the view may move about in: the default 2000 square
+    // extended to take in all of the level, with a margin around it
+    sf::FloatRect workspaceBounds();
     void undo();
-    void replay();
     void redo();
-    void addReplayItem(const Action& action);
+    // Records an action which has just been performed
+    void addReplayItem(Action action);
     void finishCurrentMovingObject();
 
 private:
     void addOrRemoveHighlightedLine(std::optional<size_t>& lineIdx, bool includeConnectedLines);
-    void addConnectedLinesToHighlight(const Line& line);
+    void addConnectedLinesToHighlight(std::size_t lineIdx);
     void moveMovingObject(std::size_t movingObjectIdx, int x, int y);
     void moveLines(int x, int y);
-    sf::Window& m_window;
+    // Merges and drops redundant lines, as a single undoable step. Returns the number removed.
+    std::size_t simplifyLines(float tolerance);
+    // Converts the selected lines to a new moving object, as a single undoable step
+    void convertHighlightedLines();
+    void setMovingObjectProperty(
+        std::size_t movingObjectIdx,
+        float MovingObject::* property,
+        float value);
+    // Asks for a new value for the property, then carries on with next (if any) whether or
+    // not one was entered
+    void editMovingObjectProperty(
+        std::size_t movingObjectIdx,
+        float MovingObject::* property,
+        const std::string& prompt,
+        std::function<void()> next = {});
+    void setTitle(const std::string& title);
+    void applyAction(const Action& action);
+    void revertAction(const Action& action);
+    void pruneSelection();
+    // All changes to m_lines after loading should go through these so that the spatial
+    // index and vertex arrays are kept in step
+    std::size_t addLine(const Line& line);
+    void deactivateLine(std::size_t idx);
+    void reactivateLine(std::size_t idx);
+    void translateLine(std::size_t idx, int x, int y);
+    void resetGeometryCaches();
+    void rebuildLineIndex();
+    void compactLinesIfNeeded();
+    void compactLines();
+    // Re-adds any of the lines the action removed which compaction has since dropped,
+    // renumbering the history
+    void restoreDroppedLines(Action& action);
+    void deleteLines(std::vector<std::size_t> indices);
+    void addLineEndpoints(std::size_t idx);
+    void removeLineEndpoints(std::size_t idx);
+    const std::vector<std::size_t>* linesAt(int x, int y) const;
+    // For wholesale changes, e.g. loading
+    void invalidateMovingObjects();
+    // After the object's lines or motion change
+    void invalidateMovingObject(std::size_t idx);
+    void insertMovingObject(std::size_t idx, const MovingObject& object);
+    void eraseMovingObject(std::size_t idx);
+    void rebuildMovingObjectGrid();
+    // Geometry is held in persistent vertex arrays which are only rebuilt (or patched)
+    // when the lines or moving objects change, rather than being regenerated each frame
+    void rebuildLineVertices();
+    void updateLineVertices(std::size_t idx);
+    void rebuildMovingObjectVertices();
+    // Updates the colour of the object's lines after its highlighting changes
+    void recolourMovingObject(std::size_t idx);
+    void highlightLine(std::size_t idx);
+    void unhighlightLine(std::size_t idx);
+    void clearHighlightedLines();
+    void rebuildSelectionVertices();
+    sf::Window* m_window; // null if not attached to a window
     std::string m_levelDescription;
     sf::Font m_font;
-    std::vector<Line> m_lines;
+    LineStore m_lines;
     std::optional<StartPosition> m_startPosition;
-    std::optional<std::pair<unsigned, unsigned>> m_exitPosition;
-    std::vector<std::pair<unsigned, unsigned>> m_fuelObjects;
+    std::optional<std::pair<int, int>> m_exitPosition;
+    std::vector<std::pair<int, int>> m_fuelObjects;
     std::vector<MovingObject> m_movingObjects;
 
+    LineChunks m_lineChunks; // vertices of the active lines, by index into m_lines
+    TileCache m_lineTiles; // the lines as last drawn, full detail or simplified
+    std::vector<sf::FloatRect> m_changedLineAreas;
+    sf::VertexArray m_movingObjectVertices { sf::PrimitiveType::Lines }; // lines and boundaries
+    sf::VertexArray m_selectionVertices { sf::PrimitiveType::Lines }; // drawn over the lines
+    sf::VertexArray m_transientVertices { sf::PrimitiveType::Lines }; // in-progress items
+    sf::VertexArray m_visibleVertices { sf::PrimitiveType::Lines }; // culled copy, per frame
+    sf::VertexArray m_gridVertices { sf::PrimitiveType::Lines };
+    sf::FloatRect m_gridArea; // the workspace covered by m_gridVertices
+    int m_gridVerticesSpacing { 0 }; // of m_gridVertices, none built yet if 0
+    struct VertexRange {
+        std::size_t first;
+        std::size_t count;
+        sf::FloatRect bounds;
+    };
+    std::vector<VertexRange> m_movingObjectVertexRanges; // per object in m_movingObjectVertices
+    // What's derived from a moving object's lines and motion, kept until either changes
+    struct MovingObjectShape {
+        sf::Vector2f centre;
+        float radius { 0.f }; // of the furthest vertex from the centre, if it rotates
+        sf::VertexArray envelope { sf::PrimitiveType::Lines }; // around everywhere it can reach
+        sf::FloatRect bounds; // of the lines and the envelope
+    };
+    MovingObjectShape makeMovingObjectShape(const MovingObject& m);
+    const MovingObjectShape& movingObjectShape(std::size_t idx);
+    std::vector<std::optional<MovingObjectShape>> m_movingObjectShapes; // as m_movingObjects
+    SpatialGrid m_movingObjectBoundsGrid { 200.f }; // indices into m_movingObjectVertexRanges
+    bool m_lineVerticesDirty { true };
+    bool m_movingObjectVerticesDirty { true };
+    bool m_selectionVerticesDirty { true };
+
+    SpatialGrid m_lineGrid; // ids are indices into m_lines
+    // Maps each (x, y) vertex to the lines which start or end there, for following chains
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> m_lineEndpoints;
+    LineLod m_lineLod; // simplified lines, drawn instead when zoomed out
+    std::size_t m_inactiveLineCount { 0 };
+    std::size_t m_inactiveLineCountAfterCompaction { 0 }; // these are all pinned by history
+    std::size_t m_nextDroppedLineId { droppedLineIdBase };
+    SpatialGrid m_movingObjectGrid; // ids are indices into m_movingObjectLineRefs
+    std::vector<std::pair<std::size_t, std::size_t>> m_movingObjectLineRefs; // object, line
+    bool m_movingObjectGridDirty { true };
+    std::vector<std::size_t> m_gridQueryResults;
+    // Reused between picking and snapping queries, to avoid allocating each time
+    SegmentBatch m_segmentBatch;
+    std::vector<std::size_t> m_segmentBatchIds; // what each segment in the batch belongs to
+    NearestPoints m_nearestPoints;
+
     std::vector<Action> m_replay; // this is used for undo/redo
-    long m_replayIndex { 0 };
+    std::size_t m_replayIndex { 0 }; // number of actions in m_replay currently applied
 
     bool m_isDialogActive { false };
     sf::RectangleShape m_dialog;
     sf::Text m_dialogTitle;
     sf::Text m_dialogText;
     std::function<void(bool, std::string)> m_dialogCallback { [](bool, const std::string&) { } };
+    std::optional<TextInput> m_dialogInput; // if the dialog takes input
+    sf::RectangleShape m_dialogInputBox;
+    sf::Text m_dialogInputText;
+    // Text is only taken once a key has been pressed in the dialog, so that the character
+    // for the key which opened it isn't
+    bool m_dialogKeyPressed { false };
     sf::Text m_editModeText;
-    std::set<std::size_t> m_highlightedLineIndices;
+    LineSelection m_highlightedLineIndices;
     std::optional<std::size_t> m_highlightedMovingObjectIdx;
-    std::optional<std::tuple<unsigned, unsigned>> m_currentNearestSnapPoint { std::nullopt };
+    std::optional<std::tuple<int, int>> m_currentNearestSnapPoint { std::nullopt };
     Line m_currentInsertionLine;
     MovingObject m_currentMovingObject;
     Mode m_currentMode { Mode::LINE };
@@ -165,7 +409,22 @@ private:
     float m_viewZoomLevel { 1.f };
     sf::View m_fixedView; // for non-moving elements, e.g. dialog
     std::string m_fileName;
-    bool m_dirty { false };
+    // Incremented by every edit, so the level has unsaved changes while this differs from
+    // m_savedGeneration
+    std::uint64_t m_editGeneration { 0 };
+    std::uint64_t m_savedGeneration { 0 };
+    struct SaveResult {
+        std::size_t bytes;
+        std::chrono::duration<double, std::milli> elapsed;
+    };
+    bool finishBackgroundSave();
+    std::future<SaveResult> m_backgroundSave; // waits for the save, if any, when destroyed
+    std::uint64_t m_savingGeneration { 0 }; // the edit generation being saved
+    // Shows the reason a save failed, unless a dialog is open, in which case it's kept in
+    // m_saveError until that dialog (and any it leads to) has closed
+    void showSaveError();
+    std::optional<std::string> m_saveError;
+    bool m_needsRedraw { true };
     std::optional<int> m_oldMouseX;
     std::optional<int> m_oldMouseY;
     CurrentPolygon m_currentPolygon;
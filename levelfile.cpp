@@ -0,0 +1,745 @@
+#include "levelfile.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// No record in the format has more fields than this
+constexpr std::size_t maxFields = 12;
+using Fields = std::array<std::string_view, maxFields>;
+
+// Splits a record into its '~' separated fields without copying anything. Returns the
+// number of fields found; any beyond maxFields are ignored.
+std::size_t splitFields(std::string_view record, Fields& fields)
+{
+    std::size_t count = 0;
+    while (count < maxFields) {
+        const auto sep = record.find('~');
+        fields[count++] = record.substr(0, sep);
+        if (sep == std::string_view::npos) {
+            break;
+        }
+        record.remove_prefix(sep + 1);
+    }
+    return count;
+}
+
+std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// The whole field must be a valid number
+template <typename T> bool parseNumber(std::string_view field, T& value)
+{
+    field = trim(field);
+    if (!field.empty() && field.front() == '+') {
+        field.remove_prefix(1);
+    }
+    const char* last = field.data() + field.size();
+    auto [ptr, ec] = std::from_chars(field.data(), last, value);
+    return ec == std::errc() && ptr == last && !field.empty();
+}
+
+bool parseCoord(std::string_view field, int& value)
+{
+    return parseNumber(field, value);
+}
+
+// The rotation was historically read via stoi, so negative values are accepted and wrap
+bool parseRotation(std::string_view field, unsigned& value)
+{
+    int v;
+    if (!parseNumber(field, v)) {
+        return false;
+    }
+    value = static_cast<unsigned>(v);
+    return true;
+}
+
+bool parseColour(std::string_view field, uint8_t& value)
+{
+    int v;
+    if (!parseNumber(field, v)) {
+        return false;
+    }
+    value = static_cast<uint8_t>(v);
+    return true;
+}
+
+enum class ObjectType {
+    OBSTRUCTION,
+    EXIT,
+    FUEL,
+    BREAKABLE,
+    MOVING
+};
+
+// Binary format layout. All values are little-endian. The file is the header, followed by
+// the description (padded to a multiple of four bytes), the static lines, the fuel
+// positions, then each moving object followed immediately by its own lines.
+constexpr char binaryMagic[4] = { 'L', 'V', 'L', 'B' };
+constexpr std::uint32_t binaryVersion = 1;
+constexpr const char* binaryExtension = ".lvb";
+
+struct BinaryHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t descriptionLength;
+    std::uint32_t lineCount;
+    std::uint32_t fuelCount;
+    std::uint32_t movingObjectCount;
+    std::int32_t startX;
+    std::int32_t startY;
+    std::int32_t startRotation;
+    std::int32_t exitX;
+    std::int32_t exitY;
+    std::uint8_t hasStart;
+    std::uint8_t hasExit;
+    std::uint8_t reserved[2];
+};
+
+struct BinaryLine {
+    std::int32_t x0;
+    std::int32_t y0;
+    std::int32_t x1;
+    std::int32_t y1;
+    std::uint8_t r;
+    std::uint8_t g;
+    std::uint8_t b;
+    std::uint8_t flags; // bit 0 is breakable
+};
+
+struct BinaryPosition {
+    std::int32_t x;
+    std::int32_t y;
+};
+
+struct BinaryMovingObject {
+    float xDelta;
+    float xMaxDifference;
+    float yDelta;
+    float yMaxDifference;
+    float rotationDelta;
+    float gravity;
+    std::uint32_t lineCount;
+};
+
+static_assert(sizeof(BinaryHeader) == 48);
+static_assert(sizeof(BinaryLine) == 20);
+static_assert(sizeof(BinaryPosition) == 8);
+static_assert(sizeof(BinaryMovingObject) == 28);
+static_assert(std::endian::native == std::endian::little, "binary levels are little-endian");
+
+BinaryLine toBinary(const mgo::Line& l)
+{
+    return { l.x0,
+             l.y0,
+             l.x1,
+             l.y1,
+             l.r,
+             l.g,
+             l.b,
+             static_cast<std::uint8_t>(l.breakable ? 1 : 0) };
+}
+
+mgo::Line fromBinary(const BinaryLine& b)
+{
+    mgo::Line l { b.x0, b.y0, b.x1, b.y1, b.r, b.g, b.b };
+    l.breakable = (b.flags & 1) != 0;
+    return l;
+}
+
+// Reads fixed-size records from a byte buffer, checking that they're actually there
+class RecordReader {
+public:
+    explicit RecordReader(std::string_view bytes)
+        : m_bytes(bytes)
+    {
+    }
+    template <typename T> T read()
+    {
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+    const char* take(std::size_t size)
+    {
+        if (size > m_bytes.size()) {
+            throw std::runtime_error("Binary level file is truncated");
+        }
+        const char* p = m_bytes.data();
+        m_bytes.remove_prefix(size);
+        return p;
+    }
+    // The next count records of type T, checking the count against what's left before
+    // working out their size, so that a corrupt count can't overflow or over-allocate
+    template <typename T> RecordReader takeRecords(std::size_t count)
+    {
+        checkCount<T>(count);
+        return RecordReader(std::string_view(take(count * sizeof(T)), count * sizeof(T)));
+    }
+    template <typename T> void checkCount(std::size_t count) const
+    {
+        if (count > m_bytes.size() / sizeof(T)) {
+            throw std::runtime_error("Binary level file is truncated");
+        }
+    }
+    // Text of the given length, padded to a multiple of four bytes
+    std::string_view takePadded(std::size_t length)
+    {
+        if (length > m_bytes.size()) {
+            throw std::runtime_error("Binary level file is truncated");
+        }
+        const std::size_t padded = (length + 3) & ~std::size_t { 3 };
+        return std::string_view(take(padded), length);
+    }
+
+private:
+    std::string_view m_bytes;
+};
+
+template <typename T> void appendRecord(std::string& out, const T& record)
+{
+    out.append(reinterpret_cast<const char*>(&record), sizeof(T));
+}
+
+// Formats text straight into a buffer with std::to_chars, producing what an ostream with its
+// default settings would
+class TextBuffer {
+public:
+    TextBuffer(char* first, char* last)
+        : m_first(first)
+        , m_next(first)
+        , m_last(last)
+    {
+    }
+    TextBuffer& operator<<(std::string_view s)
+    {
+        if (s.size() > static_cast<std::size_t>(m_last - m_next)) {
+            overflow();
+        }
+        std::memcpy(m_next, s.data(), s.size());
+        m_next += s.size();
+        return *this;
+    }
+    template <typename T>
+        requires std::is_arithmetic_v<T>
+    TextBuffer& operator<<(T value)
+    {
+        std::to_chars_result result;
+        if constexpr (std::is_floating_point_v<T>) {
+            result = std::to_chars(m_next, m_last, value, std::chars_format::general, 6);
+        } else {
+            result = std::to_chars(m_next, m_last, value);
+        }
+        if (result.ec != std::errc()) {
+            overflow();
+        }
+        m_next = result.ptr;
+        return *this;
+    }
+    std::size_t size() const { return static_cast<std::size_t>(m_next - m_first); }
+
+private:
+    [[noreturn]] static void overflow()
+    {
+        throw std::runtime_error("Level text is longer than its buffer");
+    }
+    char* m_first;
+    char* m_next;
+    char* m_last;
+};
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename)
+    {
+        m_fd = ::open(filename.c_str(), O_RDONLY);
+        if (m_fd < 0) {
+            throw(std::runtime_error("Failed to load Level file " + filename));
+        }
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0) {
+            ::close(m_fd);
+            throw(std::runtime_error("Failed to read Level file " + filename));
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0) {
+            m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (m_data == MAP_FAILED) {
+                ::close(m_fd);
+                throw(std::runtime_error("Failed to map Level file " + filename));
+            }
+        }
+    }
+    ~MappedFile()
+    {
+        if (m_data != nullptr) {
+            ::munmap(m_data, m_size);
+        }
+        ::close(m_fd);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    std::string_view contents() const
+    {
+        return m_data ? std::string_view(static_cast<const char*>(m_data), m_size)
+                      : std::string_view {};
+    }
+
+private:
+    int m_fd { -1 };
+    void* m_data { nullptr };
+    std::size_t m_size { 0 };
+};
+
+} // namespace
+
+namespace mgo {
+
+LevelData parseLevelText(std::string_view text, std::vector<ParseError>& errors)
+{
+    LevelData data;
+    data.lines.reserve(std::count(text.begin(), text.end(), '\n') + 1);
+    ObjectType currentObject = ObjectType::OBSTRUCTION;
+    std::size_t lineNumber = 0;
+    Fields f;
+    auto error = [&](std::string message) { errors.push_back({ lineNumber, std::move(message) }); };
+    while (!text.empty()) {
+        ++lineNumber;
+        const auto eol = text.find('\n');
+        std::string_view record = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+        if (!record.empty() && record.back() == '\r') {
+            record.remove_suffix(1);
+        }
+        if (record.empty()) {
+            continue;
+        }
+        const std::size_t n = splitFields(record, f);
+        switch (record.front()) {
+            case '!': // timelimit (unused), fuel (unused) , ship x, ship y, angle, description
+                {
+                    StartPosition start;
+                    if (n < 7 || !parseCoord(f[3], start.x) || !parseCoord(f[4], start.y)
+                        || !parseRotation(f[5], start.r)) {
+                        error("Invalid first line of level file");
+                        break;
+                    }
+                    data.startPosition = start;
+                    data.description = f[6];
+                    break;
+                }
+            case 'N': // New object, parameter 1 is type, parameter 2 appears unused
+                {
+                    const std::string_view type = n > 1 ? f[1] : std::string_view {};
+                    if (type == "OBSTRUCTION") {
+                        currentObject = ObjectType::OBSTRUCTION;
+                    } else if (type == "EXIT") {
+                        currentObject = ObjectType::EXIT;
+                    } else if (type == "FUEL") {
+                        currentObject = ObjectType::FUEL;
+                    } else if (type == "BREAKABLE") {
+                        currentObject = ObjectType::BREAKABLE;
+                    } else if (type == "MOVING") {
+                        currentObject = ObjectType::MOVING;
+                        MovingObject m;
+                        if (n < 8 || !parseNumber(f[3], m.xDelta)
+                            || !parseNumber(f[4], m.xMaxDifference)
+                            || !parseNumber(f[5], m.yDelta)
+                            || !parseNumber(f[6], m.yMaxDifference)
+                            || !parseNumber(f[7], m.rotationDelta)
+                            || (n > 8 && !parseNumber(f[8], m.gravity))) {
+                            error("Invalid moving object parameters");
+                        }
+                        // Still start a new object so its lines don't join the previous one
+                        data.movingObjects.push_back(std::move(m));
+                    } else {
+                        error("Unrecognised object type '" + std::string(type) + "'");
+                    }
+                    break;
+                }
+            case 'L':
+                {
+                    Line l;
+                    if (n < 8 || !parseCoord(f[1], l.x0) || !parseCoord(f[2], l.y0)
+                        || !parseCoord(f[3], l.x1) || !parseCoord(f[4], l.y1)
+                        || !parseColour(f[5], l.r) || !parseColour(f[6], l.g)
+                        || !parseColour(f[7], l.b)) {
+                        error("Invalid line record");
+                        break;
+                    }
+                    if (currentObject == ObjectType::OBSTRUCTION) {
+                        data.lines.push_back(l);
+                    } else if (currentObject == ObjectType::BREAKABLE) {
+                        l.breakable = true;
+                        data.lines.push_back(l);
+                    } else if (currentObject == ObjectType::MOVING) {
+                        data.movingObjects.back().lines.push_back(l);
+                    }
+                    break;
+                }
+            case 'P': // position
+                {
+                    std::pair<int, int> p;
+                    if (n < 3 || !parseCoord(f[1], p.first) || !parseCoord(f[2], p.second)) {
+                        error("Invalid position record");
+                        break;
+                    }
+                    if (currentObject == ObjectType::EXIT) {
+                        data.exitPosition = p;
+                    }
+                    if (currentObject == ObjectType::FUEL) {
+                        data.fuelObjects.push_back(p);
+                    }
+                    break;
+                }
+            case 'T': // text
+                break;
+            default:
+                break;
+        }
+    }
+    // Moving objects without any lines aren't kept
+    std::erase_if(data.movingObjects, [](const MovingObject& m) { return m.lines.empty(); });
+    return data;
+}
+
+namespace {
+
+// The most that formatLevelText could write, allowing the longest number in every field
+std::size_t maxLevelTextLength(const LevelData& data)
+{
+    constexpr std::size_t maxLineRecord = 4 * 12 + 20;
+    constexpr std::size_t maxObjectRecord = 128;
+    std::size_t length = 256 + data.description.size();
+    length += data.lines.size() * (maxLineRecord + 24); // room for breakable's own header
+    length += (data.fuelObjects.size() + data.movingObjects.size()) * maxObjectRecord;
+    for (const auto& m : data.movingObjects) {
+        length += m.lines.size() * maxLineRecord;
+    }
+    return length;
+}
+
+void formatLevelText(TextBuffer& out, const LevelData& data)
+{
+    // Header
+    // time limit, fuel, startX, startY, angle, title
+    int startX = 0;
+    int startY = 0;
+    unsigned rotation = 0;
+    if (data.startPosition.has_value()) {
+        startX = data.startPosition.value().x;
+        startY = data.startPosition.value().y;
+        rotation = data.startPosition.value().r;
+    }
+    out << "!~0~0~" << startX << "~" << startY << "~" << rotation << "~" << data.description
+        << "\n";
+    out << "N~OBSTRUCTION~obstruction\n";
+    for (const auto& l : data.lines) {
+        if (!l.inactive && !l.breakable) {
+            out << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1 << "~255~0~0~2\n";
+        }
+    }
+    // Each breakable line is its own object
+    for (const auto& l : data.lines) {
+        if (!l.inactive && l.breakable) {
+            out << "N~BREAKABLE~breakable\n";
+            out << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1
+                << "~255~150~50~6\n";
+        }
+    }
+    if (data.exitPosition.has_value()) {
+        out << "N~EXIT~exit\n"
+               "T~EXIT~52~213~235~6\n"
+               "P~"
+            << data.exitPosition.value().first << "~" << data.exitPosition.value().second
+            << "\n";
+    }
+    for (const auto& p : data.fuelObjects) {
+        out << "N~FUEL~fuel\n"
+               "T~*~255~255~0~12\n"
+               "P~"
+            << p.first << "~" << p.second << "\n";
+    }
+    std::size_t counter = 0;
+    for (const auto& m : data.movingObjects) {
+        out << "N~MOVING~moving_" << counter;
+        out << "~" << m.xDelta << "~" << m.xMaxDifference << "~" << m.yDelta << "~"
+            << m.yMaxDifference << "~" << m.rotationDelta << "~" << m.gravity << "\n";
+        for (const auto& l : m.lines) {
+            out << "L~" << l.x0 << "~" << l.y0 << "~" << l.x1 << "~" << l.y1 << "~"
+                << static_cast<int>(l.r) << "~" << static_cast<int>(l.g) << "~"
+                << static_cast<int>(l.b) << "~6\n";
+        }
+        ++counter;
+    }
+}
+
+// The process's umask, which can only be read by setting it, so it's only read once. Files
+// created while it's cleared are unaffected if, like the temporary files, they're created
+// by mkstemp.
+mode_t creationMask()
+{
+    static const mode_t mask = [] {
+        const mode_t m = ::umask(0);
+        ::umask(m);
+        return m;
+    }();
+    return mask;
+}
+
+} // namespace
+
+std::string levelText(const LevelData& data)
+{
+    // Allocated once at the most it could need, and not filled beforehand
+    std::string text;
+    text.resize_and_overwrite(maxLevelTextLength(data), [&data](char* buffer, std::size_t length) {
+        TextBuffer out(buffer, buffer + length);
+        formatLevelText(out, data);
+        return out.size();
+    });
+    return text;
+}
+
+void writeLevelText(std::ostream& out, const LevelData& data)
+{
+    const std::string text = levelText(data);
+    out.write(text.data(), text.size());
+}
+
+LevelData parseLevelBinary(std::string_view bytes)
+{
+    RecordReader reader(bytes);
+    const auto header = reader.read<BinaryHeader>();
+    if (std::memcmp(header.magic, binaryMagic, sizeof(binaryMagic)) != 0) {
+        throw std::runtime_error("Not a binary level file");
+    }
+    if (header.version != binaryVersion) {
+        throw std::runtime_error(
+            "Unsupported binary level file version " + std::to_string(header.version));
+    }
+    LevelData data;
+    data.description = reader.takePadded(header.descriptionLength);
+    if (header.hasStart) {
+        data.startPosition = StartPosition {
+            header.startX, header.startY, static_cast<unsigned>(header.startRotation)
+        };
+    }
+    if (header.hasExit) {
+        data.exitPosition = std::make_pair(header.exitX, header.exitY);
+    }
+    // Each block is checked to be present before reserving, so a corrupt count can't cause
+    // a huge allocation
+    auto lines = reader.takeRecords<BinaryLine>(header.lineCount);
+    data.lines.reserve(header.lineCount);
+    for (std::uint32_t i = 0; i < header.lineCount; ++i) {
+        data.lines.push_back(fromBinary(lines.read<BinaryLine>()));
+    }
+    auto fuel = reader.takeRecords<BinaryPosition>(header.fuelCount);
+    data.fuelObjects.reserve(header.fuelCount);
+    for (std::uint32_t i = 0; i < header.fuelCount; ++i) {
+        const auto p = fuel.read<BinaryPosition>();
+        data.fuelObjects.emplace_back(p.x, p.y);
+    }
+    reader.checkCount<BinaryMovingObject>(header.movingObjectCount);
+    data.movingObjects.reserve(header.movingObjectCount);
+    for (std::uint32_t i = 0; i < header.movingObjectCount; ++i) {
+        const auto b = reader.read<BinaryMovingObject>();
+        MovingObject m { b.xDelta, b.xMaxDifference, b.yDelta, b.yMaxDifference,
+                         b.rotationDelta, b.gravity, {} };
+        auto objectLines = reader.takeRecords<BinaryLine>(b.lineCount);
+        m.lines.reserve(b.lineCount);
+        for (std::uint32_t j = 0; j < b.lineCount; ++j) {
+            m.lines.push_back(fromBinary(objectLines.read<BinaryLine>()));
+        }
+        data.movingObjects.push_back(std::move(m));
+    }
+    return data;
+}
+
+std::string levelBinary(const LevelData& data)
+{
+    const auto activeLines = std::count_if(
+        data.lines.begin(), data.lines.end(), [](const Line& l) { return !l.inactive; });
+    std::size_t capacity = sizeof(BinaryHeader) + data.description.size() + 3
+        + activeLines * sizeof(BinaryLine) + data.fuelObjects.size() * sizeof(BinaryPosition);
+    for (const auto& m : data.movingObjects) {
+        capacity += sizeof(BinaryMovingObject) + m.lines.size() * sizeof(BinaryLine);
+    }
+    std::string out;
+    out.reserve(capacity);
+    BinaryHeader header {};
+    std::memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+    header.version = binaryVersion;
+    header.descriptionLength = static_cast<std::uint32_t>(data.description.size());
+    header.lineCount = static_cast<std::uint32_t>(activeLines);
+    header.fuelCount = static_cast<std::uint32_t>(data.fuelObjects.size());
+    header.movingObjectCount = static_cast<std::uint32_t>(data.movingObjects.size());
+    if (data.startPosition.has_value()) {
+        header.hasStart = 1;
+        header.startX = static_cast<std::int32_t>(data.startPosition->x);
+        header.startY = static_cast<std::int32_t>(data.startPosition->y);
+        header.startRotation = static_cast<std::int32_t>(data.startPosition->r);
+    }
+    if (data.exitPosition.has_value()) {
+        header.hasExit = 1;
+        header.exitX = static_cast<std::int32_t>(data.exitPosition->first);
+        header.exitY = static_cast<std::int32_t>(data.exitPosition->second);
+    }
+    appendRecord(out, header);
+    out.append(data.description);
+    out.append(((header.descriptionLength + 3) & ~3u) - header.descriptionLength, '\0');
+    for (const auto& l : data.lines) {
+        if (!l.inactive) {
+            appendRecord(out, toBinary(l));
+        }
+    }
+    for (const auto& p : data.fuelObjects) {
+        appendRecord(
+            out,
+            BinaryPosition { static_cast<std::int32_t>(p.first),
+                             static_cast<std::int32_t>(p.second) });
+    }
+    for (const auto& m : data.movingObjects) {
+        appendRecord(
+            out,
+            BinaryMovingObject { m.xDelta,
+                                 m.xMaxDifference,
+                                 m.yDelta,
+                                 m.yMaxDifference,
+                                 m.rotationDelta,
+                                 m.gravity,
+                                 static_cast<std::uint32_t>(m.lines.size()) });
+        for (const auto& l : m.lines) {
+            appendRecord(out, toBinary(l));
+        }
+    }
+    return out;
+}
+
+void writeLevelBinary(std::ostream& out, const LevelData& data)
+{
+    const std::string bytes = levelBinary(data);
+    out.write(bytes.data(), bytes.size());
+}
+
+bool isBinaryLevelFile(const std::string& filename)
+{
+    return std::filesystem::path(filename).extension() == binaryExtension;
+}
+
+LevelData readLevelFile(const std::string& filename, std::vector<ParseError>& errors)
+{
+    const MappedFile file(filename);
+    const std::string_view contents = file.contents();
+    if (contents.size() >= sizeof(binaryMagic)
+        && std::memcmp(contents.data(), binaryMagic, sizeof(binaryMagic)) == 0) {
+        return parseLevelBinary(contents);
+    }
+    return parseLevelText(contents, errors);
+}
+
+std::size_t writeLevelFile(const std::string& filename, const LevelData& data)
+{
+    const std::string contents
+        = isBinaryLevelFile(filename) ? levelBinary(data) : levelText(data);
+    // A symlink is left in place, and the file it points to replaced
+    std::string target = filename;
+    std::error_code ec;
+    if (const auto resolved = std::filesystem::canonical(filename, ec); !ec) {
+        target = resolved.string();
+    }
+    // Written next to the original, as a rename is only atomic within a file system
+    std::string temporary = target + ".XXXXXX";
+    const int fd = ::mkstemp(temporary.data());
+    if (fd < 0) {
+        throw(std::runtime_error(
+            "Failed to create a temporary file for " + filename + ": " + std::strerror(errno)));
+    }
+    auto fail = [&](bool open) {
+        const int error = errno;
+        if (open) {
+            ::close(fd);
+        }
+        ::unlink(temporary.c_str());
+        throw(std::runtime_error("Failed to write " + filename + ": " + std::strerror(error)));
+    };
+    // mkstemp only allows the owner access, so keep the original's permissions, or give a
+    // new file the ones it would have had if created directly
+    struct stat st;
+    const mode_t mode
+        = ::stat(target.c_str(), &st) == 0 ? st.st_mode & 07777 : 0666 & ~creationMask();
+    if (::fchmod(fd, mode) != 0) {
+        fail(true);
+    }
+    const char* p = contents.data();
+    std::size_t remaining = contents.size();
+    while (remaining > 0) {
+        // Normally all written at once, but a write may be cut short
+        const ssize_t written = ::write(fd, p, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail(true);
+        }
+        p += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+    if (::fsync(fd) != 0) {
+        fail(true);
+    }
+    if (::close(fd) != 0) {
+        fail(false);
+    }
+    if (::rename(temporary.c_str(), target.c_str()) != 0) {
+        fail(false);
+    }
+    // The rename itself is only durable once the directory holding the file is synced
+    const auto directory = std::filesystem::path(target).parent_path();
+    const int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0 || ::fsync(dirFd) != 0) {
+        const int error = errno;
+        if (dirFd >= 0) {
+            ::close(dirFd);
+        }
+        throw(std::runtime_error(
+            "Failed to sync the directory of " + filename + ": " + std::strerror(error)));
+    }
+    ::close(dirFd);
+    return contents.size();
+}
+
+void convertLevelFile(
+    const std::string& from,
+    const std::string& to,
+    std::vector<ParseError>& errors)
+{
+    writeLevelFile(to, readLevelFile(from, errors));
+}
+
+} // namespace mgo
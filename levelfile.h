@@ -0,0 +1,59 @@
+#pragma once
+
+#include "level.h"
+
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mgo {
+
+// Everything which is stored in a level file
+struct LevelData {
+    std::string description;
+    std::vector<Line> lines;
+    std::optional<StartPosition> startPosition;
+    std::optional<std::pair<int, int>> exitPosition;
+    std::vector<std::pair<int, int>> fuelObjects;
+    std::vector<MovingObject> movingObjects;
+};
+
+struct ParseError {
+    std::size_t lineNumber;
+    std::string message;
+};
+
+// Parses the '~' separated text level format. Malformed records are skipped and reported
+// in errors rather than aborting the whole load.
+LevelData parseLevelText(std::string_view text, std::vector<ParseError>& errors);
+// Formats the whole level into one buffer, allocated once
+std::string levelText(const LevelData& data);
+void writeLevelText(std::ostream& out, const LevelData& data);
+
+// The binary format holds the same information as the text format as packed fixed-size
+// records, so it can be read straight out of a memory-mapped file. The text format remains
+// the one to use for interchange and diffs. Throws if the data is truncated or corrupt.
+LevelData parseLevelBinary(std::string_view bytes);
+std::string levelBinary(const LevelData& data);
+void writeLevelBinary(std::ostream& out, const LevelData& data);
+bool isBinaryLevelFile(const std::string& filename); // judged by extension
+
+// Reads either format, detected by its magic number. Throws if the file can't be read.
+LevelData readLevelFile(const std::string& filename, std::vector<ParseError>& errors);
+// Writes the binary format if the filename has the binary extension, otherwise text. The
+// level goes to a uniquely named temporary file beside the original (or beside the file a
+// symlink points to), which is synced to disk and then renamed over it, and the directory is
+// synced after. A save which fails part way leaves the original as it was, and the original's
+// permissions are kept. Returns the number of bytes written. Throws if the file can't be
+// written.
+std::size_t writeLevelFile(const std::string& filename, const LevelData& data);
+// Converts between formats, in either direction, based on the filenames' extensions
+void convertLevelFile(
+    const std::string& from,
+    const std::string& to,
+    std::vector<ParseError>& errors);
+
+} // namespace mgo
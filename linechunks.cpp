@@ -0,0 +1,193 @@
+#include "linechunks.h"
+#include "level.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+sf::FloatRect lineBounds(const mgo::Line& l)
+{
+    const sf::Vector2f min(std::min(l.x0, l.x1), std::min(l.y0, l.y1));
+    const sf::Vector2f max(std::max(l.x0, l.x1), std::max(l.y0, l.y1));
+    return { min, max - min };
+}
+
+sf::FloatRect lineBounds(const sf::Vertex& v0, const sf::Vertex& v1)
+{
+    const sf::Vector2f min(
+        std::min(v0.position.x, v1.position.x), std::min(v0.position.y, v1.position.y));
+    const sf::Vector2f max(
+        std::max(v0.position.x, v1.position.x), std::max(v0.position.y, v1.position.y));
+    return { min, max - min };
+}
+
+sf::FloatRect unite(const sf::FloatRect& a, const sf::FloatRect& b)
+{
+    const sf::Vector2f min(
+        std::min(a.position.x, b.position.x), std::min(a.position.y, b.position.y));
+    const sf::Vector2f max(
+        std::max(a.position.x + a.size.x, b.position.x + b.size.x),
+        std::max(a.position.y + a.size.y, b.position.y + b.size.y));
+    return { min, max - min };
+}
+
+} // namespace
+
+namespace mgo {
+
+LineChunks::LineChunks(float chunkSize)
+    : m_chunkSize(chunkSize)
+{
+}
+
+void LineChunks::clear()
+{
+    m_chunks.clear();
+    m_slots.clear();
+    m_changedAreas.clear();
+    m_allChanged = true;
+}
+
+void LineChunks::set(std::size_t id, const Line& line, sf::Color colour)
+{
+    if (id >= m_slots.size()) {
+        m_slots.resize(id + 1, { 0, noIndex });
+    }
+    const std::uint64_t key = chunkKey(line);
+    if (m_slots[id].index != noIndex && m_slots[id].chunk != key) {
+        remove(id);
+    }
+    const sf::Vector2f p0(line.x0, line.y0);
+    const sf::Vector2f p1(line.x1, line.y1);
+    Slot& slot = m_slots[id];
+    if (slot.index == noIndex) {
+        Chunk& chunk = m_chunks[key];
+        if (chunk.ids.empty()) {
+            chunk.bounds = lineBounds(line);
+        } else if (!chunk.boundsDirty) {
+            chunk.bounds = unite(chunk.bounds, lineBounds(line));
+        }
+        slot = { key, chunk.ids.size() };
+        chunk.ids.push_back(id);
+        chunk.vertices.append({ p0, colour });
+        chunk.vertices.append({ p1, colour });
+        noteChange(lineBounds(line));
+        return;
+    }
+    Chunk& chunk = m_chunks.find(key)->second;
+    sf::Vertex& v0 = chunk.vertices[slot.index * 2];
+    sf::Vertex& v1 = chunk.vertices[slot.index * 2 + 1];
+    if (v0.position != p0 || v1.position != p1) {
+        chunk.boundsDirty = true;
+    }
+    if (v0.position != p0 || v1.position != p1 || v0.color != colour) {
+        noteChange(lineBounds(v0, v1));
+        noteChange(lineBounds(line));
+    }
+    v0 = { p0, colour };
+    v1 = { p1, colour };
+}
+
+void LineChunks::remove(std::size_t id)
+{
+    if (id >= m_slots.size() || m_slots[id].index == noIndex) {
+        return;
+    }
+    const Slot slot = m_slots[id];
+    auto it = m_chunks.find(slot.chunk);
+    Chunk& chunk = it->second;
+    noteChange(lineBounds(chunk.vertices[slot.index * 2], chunk.vertices[slot.index * 2 + 1]));
+    // The chunk's last line is moved into the gap
+    const std::size_t last = chunk.ids.size() - 1;
+    if (slot.index != last) {
+        const std::size_t moved = chunk.ids[last];
+        chunk.ids[slot.index] = moved;
+        chunk.vertices[slot.index * 2] = chunk.vertices[last * 2];
+        chunk.vertices[slot.index * 2 + 1] = chunk.vertices[last * 2 + 1];
+        m_slots[moved].index = slot.index;
+    }
+    chunk.ids.pop_back();
+    chunk.vertices.resize(last * 2);
+    m_slots[id].index = noIndex;
+    if (chunk.ids.empty()) {
+        m_chunks.erase(it);
+    } else {
+        chunk.boundsDirty = true;
+    }
+}
+
+void LineChunks::draw(sf::RenderTarget& target, const sf::FloatRect& area)
+{
+    for (auto& [key, chunk] : m_chunks) {
+        const sf::FloatRect& b = chunkBounds(chunk);
+        // Inclusive, as the bounds of a run of horizontal or vertical lines have no area
+        if (b.position.x <= area.position.x + area.size.x
+            && area.position.x <= b.position.x + b.size.x
+            && b.position.y <= area.position.y + area.size.y
+            && area.position.y <= b.position.y + b.size.y) {
+            target.draw(chunk.vertices);
+            PROFILE_DRAW_CALL(chunk.vertices.getVertexCount());
+        }
+    }
+}
+
+std::optional<sf::FloatRect> LineChunks::bounds()
+{
+    std::optional<sf::FloatRect> result;
+    for (auto& [key, chunk] : m_chunks) {
+        const sf::FloatRect& b = chunkBounds(chunk);
+        result = result.has_value() ? unite(*result, b) : b;
+    }
+    return result;
+}
+
+bool LineChunks::takeChangedAreas(std::vector<sf::FloatRect>& areas)
+{
+    areas.clear();
+    areas.swap(m_changedAreas);
+    const bool tracked = !m_allChanged;
+    m_allChanged = false;
+    return tracked;
+}
+
+void LineChunks::noteChange(const sf::FloatRect& area)
+{
+    if (m_allChanged) {
+        return;
+    }
+    if (m_changedAreas.size() == maxChangedAreas) {
+        // Not worth keeping track of individually (and nothing may be asking for them)
+        m_changedAreas.clear();
+        m_allChanged = true;
+        return;
+    }
+    m_changedAreas.push_back(area);
+}
+
+std::uint64_t LineChunks::chunkKey(const Line& line) const
+{
+    const auto cx = static_cast<std::int32_t>(std::floor(line.x0 / m_chunkSize));
+    const auto cy = static_cast<std::int32_t>(std::floor(line.y0 / m_chunkSize));
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32)
+        | static_cast<std::uint32_t>(cy);
+}
+
+const sf::FloatRect& LineChunks::chunkBounds(Chunk& chunk)
+{
+    if (chunk.boundsDirty) {
+        sf::Vector2f min = chunk.vertices[0].position;
+        sf::Vector2f max = min;
+        for (std::size_t i = 1; i < chunk.vertices.getVertexCount(); ++i) {
+            const sf::Vector2f& p = chunk.vertices[i].position;
+            min = { std::min(min.x, p.x), std::min(min.y, p.y) };
+            max = { std::max(max.x, p.x), std::max(max.y, p.y) };
+        }
+        chunk.bounds = { min, max - min };
+        chunk.boundsDirty = false;
+    }
+    return chunk.bounds;
+}
+
+} // namespace mgo
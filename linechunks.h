@@ -0,0 +1,57 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace mgo {
+
+struct Line;
+
+// Vertices for a set of lines, held in square chunks of the world so that drawing only
+// touches the chunks in view and memory is only used where there are lines. Each line
+// belongs to the chunk containing its first point; a chunk's bounds cover the whole of
+// every line in it, so long lines are still drawn when only their far end is in view.
+class LineChunks {
+public:
+    explicit LineChunks(float chunkSize = 1024.f);
+    void clear();
+    // Adds the line, or updates it if it's already held (moving it between chunks if need be)
+    void set(std::size_t id, const Line& line, sf::Color colour);
+    void remove(std::size_t id);
+    // One draw call per chunk overlapping the area
+    void draw(sf::RenderTarget& target, const sf::FloatRect& area);
+    // The area covered by all of the lines, or none if there aren't any
+    std::optional<sf::FloatRect> bounds();
+    // Hands over the areas where lines have been drawn differently since the last call, for
+    // caches of what's been drawn. Returns false if everything should be taken to have
+    // changed instead, as after clear() or a great many changes.
+    bool takeChangedAreas(std::vector<sf::FloatRect>& areas);
+
+private:
+    struct Chunk {
+        sf::VertexArray vertices { sf::PrimitiveType::Lines }; // two per line
+        std::vector<std::size_t> ids; // of the lines, in vertex order
+        sf::FloatRect bounds {};
+        bool boundsDirty { false }; // after a line is removed, as the bounds may shrink
+    };
+    struct Slot {
+        std::uint64_t chunk;
+        std::size_t index; // into the chunk's ids
+    };
+    static constexpr std::size_t noIndex = static_cast<std::size_t>(-1);
+    std::uint64_t chunkKey(const Line& line) const;
+    const sf::FloatRect& chunkBounds(Chunk& chunk);
+    void noteChange(const sf::FloatRect& area);
+    static constexpr std::size_t maxChangedAreas = 4096;
+    float m_chunkSize;
+    std::unordered_map<std::uint64_t, Chunk> m_chunks;
+    std::vector<Slot> m_slots; // indexed by line id
+    std::vector<sf::FloatRect> m_changedAreas;
+    bool m_allChanged { true };
+};
+
+} // namespace mgo
@@ -0,0 +1,264 @@
+#include "linelod.h"
+#include "level.h"
+#include "linestore.h"
+#include "simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// The most a simplified line may be out by, in pixels, at the smallest zoom level of its band
+constexpr float pixelTolerance = 0.5f;
+
+bool sameKind(const mgo::Line& a, const mgo::Line& b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.breakable == b.breakable;
+}
+
+} // namespace
+
+namespace mgo {
+
+LineLod::LineLod(const LineStore& lines, EndpointLookup endpoints)
+    : m_lines(lines)
+    , m_endpoints(std::move(endpoints))
+{
+}
+
+std::optional<std::size_t> LineLod::bandForZoom(float zoomLevel)
+{
+    // Band n covers zoom levels from 2^(n+1) up to 2^(n+2)
+    if (zoomLevel < 2.f) {
+        return std::nullopt;
+    }
+    const auto band = static_cast<std::size_t>(std::floor(std::log2(zoomLevel))) - 1;
+    return std::min(band, bandCount - 1);
+}
+
+void LineLod::invalidateLine(std::size_t idx)
+{
+    if (m_allUnchained) {
+        return; // everything will be traced before the next draw anyway
+    }
+    if (m_chainOfLine.size() < m_lines.size()) {
+        m_chainOfLine.resize(m_lines.size(), noChain);
+    }
+    if (m_chainOfLine[idx] != noChain) {
+        dissolveChain(m_chainOfLine[idx]);
+    } else {
+        queueLine(idx);
+    }
+    // Lines meeting this one may now continue through these vertices, or no longer do
+    const Line l = m_lines[idx];
+    dissolveChainsAt(l.x0, l.y0);
+    dissolveChainsAt(l.x1, l.y1);
+}
+
+void LineLod::invalidateAll()
+{
+    m_chains.clear();
+    m_freeChains.clear();
+    m_chainOfLine.clear();
+    m_unchainedLines.clear();
+    m_isQueued.clear();
+    m_allUnchained = true;
+    for (auto& band : m_bands) {
+        band.lines.clear();
+        band.slotCount = 0;
+        band.freeSlots.clear();
+        band.pendingChains.clear();
+        band.isPending.clear();
+    }
+}
+
+void LineLod::draw(std::size_t band, sf::RenderTarget& target, const sf::FloatRect& area)
+{
+    update(band);
+    m_bands[band].lines.draw(target, area);
+}
+
+bool LineLod::takeChangedAreas(std::size_t band, std::vector<sf::FloatRect>& areas)
+{
+    return m_bands[band].lines.takeChangedAreas(areas);
+}
+
+void LineLod::update(std::size_t bandIdx)
+{
+    traceChains();
+    Band& band = m_bands[bandIdx];
+    const float tolerance = pixelTolerance * std::exp2(static_cast<float>(bandIdx + 1));
+    for (const std::uint32_t chainIdx : band.pendingChains) {
+        band.isPending[chainIdx] = 0;
+        Chain& chain = m_chains[chainIdx];
+        if (chain.lines.empty() || chain.firstSlot[bandIdx] != noSlot) {
+            continue; // broken up since, or its slot was reused by a chain already added
+        }
+        auto& simplified = chain.simplified[bandIdx];
+        for (const std::size_t i : simplifyPolyline(chain.points, tolerance)) {
+            simplified.push_back(chain.points[i]);
+        }
+        const auto count = static_cast<std::uint32_t>(simplified.size() - 1);
+        const std::uint32_t first = allocateSlots(band, count);
+        chain.firstSlot[bandIdx] = first;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const Line l { static_cast<int>(simplified[i].x),
+                           static_cast<int>(simplified[i].y),
+                           static_cast<int>(simplified[i + 1].x),
+                           static_cast<int>(simplified[i + 1].y) };
+            band.lines.set(first + i, l, chain.colour);
+        }
+    }
+    band.pendingChains.clear();
+}
+
+std::uint32_t LineLod::allocateSlots(Band& band, std::uint32_t count)
+{
+    if (const auto it = band.freeSlots.find(count);
+        it != band.freeSlots.end() && !it->second.empty()) {
+        const std::uint32_t first = it->second.back();
+        it->second.pop_back();
+        return first;
+    }
+    const std::uint32_t first = band.slotCount;
+    band.slotCount += count;
+    return first;
+}
+
+void LineLod::dissolveChain(std::uint32_t chainIdx)
+{
+    Chain& chain = m_chains[chainIdx];
+    for (const std::size_t i : chain.lines) {
+        m_chainOfLine[i] = noChain;
+        queueLine(i);
+    }
+    for (std::size_t bandIdx = 0; bandIdx < bandCount; ++bandIdx) {
+        const std::uint32_t first = chain.firstSlot[bandIdx];
+        if (first == noSlot) {
+            continue;
+        }
+        Band& band = m_bands[bandIdx];
+        const auto count = static_cast<std::uint32_t>(chain.simplified[bandIdx].size() - 1);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            band.lines.remove(first + i);
+        }
+        band.freeSlots[count].push_back(first);
+    }
+    chain = Chain {};
+    m_freeChains.push_back(chainIdx);
+}
+
+void LineLod::dissolveChainsAt(int x, int y)
+{
+    if (const auto* lines = m_endpoints(x, y)) {
+        for (const std::size_t i : *lines) {
+            if (m_chainOfLine[i] != noChain) {
+                dissolveChain(m_chainOfLine[i]);
+            }
+        }
+    }
+}
+
+void LineLod::traceChains()
+{
+    m_chainOfLine.resize(m_lines.size(), noChain);
+    if (m_allUnchained) {
+        for (std::size_t i = 0; i < m_lines.size(); ++i) {
+            if (!m_lines.inactive(i) && m_chainOfLine[i] == noChain) {
+                traceChain(i);
+            }
+        }
+        m_allUnchained = false;
+        return;
+    }
+    for (const std::size_t i : m_unchainedLines) {
+        m_isQueued[i] = 0;
+        if (i < m_lines.size() && !m_lines.inactive(i) && m_chainOfLine[i] == noChain) {
+            traceChain(i);
+        }
+    }
+    m_unchainedLines.clear();
+}
+
+void LineLod::queueLine(std::size_t idx)
+{
+    // Lines are queued on every edit until a band is drawn, so each is only queued once
+    if (idx >= m_isQueued.size()) {
+        m_isQueued.resize(std::max(idx + 1, m_lines.size()), 0);
+    }
+    if (!m_isQueued[idx]) {
+        m_isQueued[idx] = 1;
+        m_unchainedLines.push_back(idx);
+    }
+}
+
+void LineLod::traceChain(std::size_t first)
+{
+    std::uint32_t chainIdx;
+    if (m_freeChains.empty()) {
+        chainIdx = static_cast<std::uint32_t>(m_chains.size());
+        m_chains.emplace_back();
+    } else {
+        chainIdx = m_freeChains.back();
+        m_freeChains.pop_back();
+    }
+    const Line start = m_lines[first];
+    m_chainOfLine[first] = chainIdx;
+    std::vector<std::size_t> lines { first };
+
+    // Follows the chain away from the first line through the given vertex for as long as
+    // exactly two lines meet at each vertex, adding the vertices passed through to points
+    auto walk = [&](int x, int y, std::vector<sf::Vector2f>& points) {
+        std::size_t current = first;
+        for (;;) {
+            const auto* at = m_endpoints(x, y);
+            if (at == nullptr || at->size() != 2) {
+                return;
+            }
+            const std::size_t next = (*at)[0] == current ? (*at)[1] : (*at)[0];
+            if (next == current || m_chainOfLine[next] != noChain
+                || !sameKind(m_lines[next], start)) {
+                return;
+            }
+            const Line l = m_lines[next];
+            m_chainOfLine[next] = chainIdx;
+            lines.push_back(next);
+            if (l.x0 == x && l.y0 == y) {
+                x = l.x1;
+                y = l.y1;
+            } else {
+                x = l.x0;
+                y = l.y0;
+            }
+            points.emplace_back(static_cast<float>(x), static_cast<float>(y));
+            current = next;
+        }
+    };
+    std::vector<sf::Vector2f> backwards;
+    walk(start.x0, start.y0, backwards);
+    std::vector<sf::Vector2f> forwards;
+    walk(start.x1, start.y1, forwards);
+
+    Chain& chain = m_chains[chainIdx];
+    chain.lines = std::move(lines);
+    chain.firstSlot.fill(noSlot);
+    chain.colour = { start.r, start.g, start.b };
+    chain.points.assign(backwards.rbegin(), backwards.rend());
+    chain.points.emplace_back(static_cast<float>(start.x0), static_cast<float>(start.y0));
+    chain.points.emplace_back(static_cast<float>(start.x1), static_cast<float>(start.y1));
+    chain.points.insert(chain.points.end(), forwards.begin(), forwards.end());
+    // Bands which aren't drawn keep chains pending, which may be broken up and their index
+    // reused any number of times in the meantime, so each index is only added once
+    for (auto& band : m_bands) {
+        if (chainIdx >= band.isPending.size()) {
+            band.isPending.resize(m_chains.size(), 0);
+        }
+        if (!band.isPending[chainIdx]) {
+            band.isPending[chainIdx] = 1;
+            band.pendingChains.push_back(chainIdx);
+        }
+    }
+}
+
+} // namespace mgo
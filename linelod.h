@@ -0,0 +1,83 @@
+#pragma once
+#include "linechunks.h"
+
+#include <SFML/Graphics.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace mgo {
+
+class LineStore;
+
+// Simplified copies of the static lines for drawing when zoomed out, where thousands of
+// short segments would otherwise each be drawn within a pixel or two of one another.
+// Lines are grouped into chains (runs of lines of the same kind joined end to end with no
+// branches) and each chain is simplified separately for each zoom band. Chains are only
+// traced and simplified when a band is first drawn after a change, and edits only break
+// up the chains at the vertices they touch. Each chain's simplified lines occupy a range of
+// slots in each band's LineChunks, so only the chains broken up or traced are rewritten.
+class LineLod {
+public:
+    // The active lines with an endpoint at the given vertex, or null if there are none
+    using EndpointLookup = std::function<const std::vector<std::size_t>*(int x, int y)>;
+
+    LineLod(const LineStore& lines, EndpointLookup endpoints);
+    // The band to draw at the given zoom level, or none if lines should be drawn in full
+    static std::optional<std::size_t> bandForZoom(float zoomLevel);
+    // Call while the line is active, both before and after a change to it
+    void invalidateLine(std::size_t idx);
+    // For wholesale changes, e.g. loading or compaction
+    void invalidateAll();
+    // Traces and simplifies any chains the band is missing after changes
+    void update(std::size_t band);
+    // The areas where the band's simplified lines have changed, as covered by the chains
+    // broken up and those traced in their place; see LineChunks::takeChangedAreas
+    bool takeChangedAreas(std::size_t band, std::vector<sf::FloatRect>& areas);
+    // Draws the band's simplified lines which are within the area
+    void draw(std::size_t band, sf::RenderTarget& target, const sf::FloatRect& area);
+
+private:
+    static constexpr std::size_t bandCount = 8;
+    static constexpr std::uint32_t noChain = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint32_t noSlot = std::numeric_limits<std::uint32_t>::max();
+    struct Chain {
+        std::vector<std::size_t> lines; // empty once the chain has been broken up
+        std::vector<sf::Vector2f> points;
+        sf::Color colour;
+        std::array<std::vector<sf::Vector2f>, bandCount> simplified {};
+        // First of the slots in each band's lines holding the simplified lines, one per
+        // segment of simplified, or noSlot if they haven't been added to the band yet
+        std::array<std::uint32_t, bandCount> firstSlot {};
+    };
+    struct Band {
+        LineChunks lines; // ids are slots
+        std::uint32_t slotCount { 0 };
+        // Ranges of slots freed by chains breaking up, by length, for reuse
+        std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> freeSlots;
+        std::vector<std::uint32_t> pendingChains; // traced since the band was last drawn
+        std::vector<char> isPending; // indexed as m_chains, whether in pendingChains
+    };
+    std::uint32_t allocateSlots(Band& band, std::uint32_t count);
+    void dissolveChain(std::uint32_t chain);
+    void dissolveChainsAt(int x, int y);
+    void traceChains();
+    void traceChain(std::size_t first);
+    void queueLine(std::size_t idx);
+    const LineStore& m_lines;
+    EndpointLookup m_endpoints;
+    std::vector<Chain> m_chains;
+    std::vector<std::uint32_t> m_freeChains;
+    std::vector<std::uint32_t> m_chainOfLine; // indexed as m_lines
+    std::vector<std::size_t> m_unchainedLines; // may hold inactive lines
+    std::vector<char> m_isQueued; // indexed as m_lines, whether in m_unchainedLines
+    bool m_allUnchained { true };
+    std::array<Band, bandCount> m_bands;
+};
+
+} // namespace mgo
@@ -0,0 +1,197 @@
+#include "linestore.h"
+#include "level.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+struct Extent {
+    std::int64_t minX;
+    std::int64_t minY;
+    std::int64_t maxX;
+    std::int64_t maxY;
+};
+
+void extend(Extent& extent, const mgo::Line& l)
+{
+    extent.minX = std::min<std::int64_t>({ extent.minX, l.x0, l.x1 });
+    extent.minY = std::min<std::int64_t>({ extent.minY, l.y0, l.y1 });
+    extent.maxX = std::max<std::int64_t>({ extent.maxX, l.x0, l.x1 });
+    extent.maxY = std::max<std::int64_t>({ extent.maxY, l.y0, l.y1 });
+}
+
+Extent emptyExtent()
+{
+    // Beyond any int coordinate either way, without overflowing when subtracted
+    return { std::numeric_limits<int>::max() + 1LL,
+             std::numeric_limits<int>::max() + 1LL,
+             std::numeric_limits<int>::min() - 1LL,
+             std::numeric_limits<int>::min() - 1LL };
+}
+
+} // namespace
+
+namespace mgo {
+
+void LineStore::clear()
+{
+    m_wide = false;
+    m_originX = 0;
+    m_originY = 0;
+    m_narrow.clear();
+    m_wideCoordinates.clear();
+    m_flags.clear();
+    m_colours.clear();
+}
+
+void LineStore::assign(const std::vector<Line>& lines)
+{
+    clear();
+    Extent extent = emptyExtent();
+    for (const auto& l : lines) {
+        extend(extent, l);
+    }
+    chooseEncoding(extent.minX, extent.minY, extent.maxX, extent.maxY);
+    (m_wide ? m_wideCoordinates.reserve(lines.size()) : m_narrow.reserve(lines.size()));
+    m_flags.reserve(lines.size());
+    m_colours.reserve(lines.size());
+    for (const auto& l : lines) {
+        push_back(l);
+    }
+}
+
+void LineStore::push_back(const Line& line)
+{
+    if (!m_wide && !fitsNarrow(line)) {
+        reencode(line);
+    }
+    if (m_wide) {
+        m_wideCoordinates.emplace_back();
+    } else {
+        m_narrow.emplace_back();
+    }
+    m_flags.emplace_back();
+    m_colours.emplace_back();
+    set(size() - 1, line);
+}
+
+void LineStore::resize(std::size_t count)
+{
+    (m_wide ? m_wideCoordinates.resize(count) : m_narrow.resize(count));
+    m_flags.resize(count);
+    m_colours.resize(count);
+}
+
+Line LineStore::operator[](std::size_t idx) const
+{
+    Line l;
+    if (m_wide) {
+        const auto& c = m_wideCoordinates[idx];
+        l = { c[0], c[1], c[2], c[3] };
+    } else {
+        const auto& c = m_narrow[idx];
+        l = { m_originX + c[0], m_originY + c[1], m_originX + c[2], m_originY + c[3] };
+    }
+    const Colour& colour = m_colours[idx];
+    l.r = colour.r;
+    l.g = colour.g;
+    l.b = colour.b;
+    l.thickness = colour.thickness;
+    l.inactive = m_flags[idx] & inactiveFlag;
+    l.breakable = m_flags[idx] & breakableFlag;
+    return l;
+}
+
+void LineStore::set(std::size_t idx, const Line& line)
+{
+    if (!m_wide && !fitsNarrow(line)) {
+        reencode(line);
+    }
+    writeCoordinates(idx, line);
+    m_colours[idx] = { line.r, line.g, line.b, line.thickness };
+    m_flags[idx] = (line.inactive ? inactiveFlag : 0) | (line.breakable ? breakableFlag : 0);
+}
+
+void LineStore::setInactive(std::size_t idx, bool inactive)
+{
+    if (inactive) {
+        m_flags[idx] |= inactiveFlag;
+    } else {
+        m_flags[idx] &= ~inactiveFlag;
+    }
+}
+
+std::vector<Line> LineStore::toVector() const
+{
+    std::vector<Line> lines;
+    lines.reserve(size());
+    for (std::size_t idx = 0; idx < size(); ++idx) {
+        lines.push_back((*this)[idx]);
+    }
+    return lines;
+}
+
+std::size_t LineStore::bytesUsed() const
+{
+    return m_narrow.capacity() * sizeof(m_narrow[0])
+        + m_wideCoordinates.capacity() * sizeof(m_wideCoordinates[0])
+        + m_flags.capacity() * sizeof(m_flags[0]) + m_colours.capacity() * sizeof(m_colours[0]);
+}
+
+bool LineStore::fitsNarrow(const Line& line) const
+{
+    auto fits = [](std::int64_t v, int origin) { return v >= origin && v - origin <= narrowRange; };
+    return fits(line.x0, m_originX) && fits(line.x1, m_originX) && fits(line.y0, m_originY)
+        && fits(line.y1, m_originY);
+}
+
+void LineStore::chooseEncoding(
+    std::int64_t minX, std::int64_t minY, std::int64_t maxX, std::int64_t maxY)
+{
+    m_wide = maxX - minX > narrowRange || maxY - minY > narrowRange;
+    if (m_wide || minX > maxX) {
+        m_originX = 0;
+        m_originY = 0;
+        return;
+    }
+    // Centred on what's there, so that growth in any direction fits for as long as possible
+    auto origin = [](std::int64_t min, std::int64_t max) {
+        const std::int64_t origin = min - (narrowRange - (max - min)) / 2;
+        return static_cast<int>(std::max<std::int64_t>(origin, std::numeric_limits<int>::min()));
+    };
+    m_originX = origin(minX, maxX);
+    m_originY = origin(minY, maxY);
+}
+
+void LineStore::reencode(const Line& incoming)
+{
+    const std::vector<Line> lines = toVector();
+    Extent extent = emptyExtent();
+    for (const auto& l : lines) {
+        extend(extent, l);
+    }
+    extend(extent, incoming);
+    chooseEncoding(extent.minX, extent.minY, extent.maxX, extent.maxY);
+    // Only one of the columns is in use, so the other's memory is released
+    m_narrow = {};
+    m_wideCoordinates = {};
+    (m_wide ? m_wideCoordinates.resize(lines.size()) : m_narrow.resize(lines.size()));
+    for (std::size_t idx = 0; idx < lines.size(); ++idx) {
+        writeCoordinates(idx, lines[idx]);
+    }
+}
+
+void LineStore::writeCoordinates(std::size_t idx, const Line& line)
+{
+    if (m_wide) {
+        m_wideCoordinates[idx] = { line.x0, line.y0, line.x1, line.y1 };
+    } else {
+        m_narrow[idx] = { static_cast<std::uint16_t>(line.x0 - m_originX),
+                          static_cast<std::uint16_t>(line.y0 - m_originY),
+                          static_cast<std::uint16_t>(line.x1 - m_originX),
+                          static_cast<std::uint16_t>(line.y1 - m_originY) };
+    }
+}
+
+} // namespace mgo
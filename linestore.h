@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mgo {
+
+struct Line;
+
+// The level's lines held as separate columns of coordinates, flags and colours, so that
+// loops which only look at positions or whether a line is active stream through contiguous
+// memory. While every coordinate is within 65535 of the store's origin, they are held as
+// 16-bit offsets from it; otherwise (or once content is spread further than that) they're
+// held in full. Either way the Line given back is exactly the one stored.
+class LineStore {
+public:
+    std::size_t size() const { return m_flags.size(); }
+    bool empty() const { return m_flags.empty(); }
+    void clear();
+    void assign(const std::vector<Line>& lines);
+    void push_back(const Line& line);
+    // Keeps the first count lines
+    void resize(std::size_t count);
+    Line operator[](std::size_t idx) const;
+    void set(std::size_t idx, const Line& line);
+    bool inactive(std::size_t idx) const { return m_flags[idx] & inactiveFlag; }
+    void setInactive(std::size_t idx, bool inactive);
+    std::vector<Line> toVector() const;
+    // Memory held by the columns, for comparing with a vector of Line
+    std::size_t bytesUsed() const;
+
+private:
+    static constexpr std::uint8_t inactiveFlag = 1;
+    static constexpr std::uint8_t breakableFlag = 2;
+    static constexpr std::int64_t narrowRange = 65535;
+    struct Colour {
+        std::uint8_t r;
+        std::uint8_t g;
+        std::uint8_t b;
+        std::uint8_t thickness;
+    };
+    bool fitsNarrow(const Line& line) const;
+    // Narrow with an origin leaving room either side if the extent allows, otherwise wide
+    void chooseEncoding(
+        std::int64_t minX, std::int64_t minY, std::int64_t maxX, std::int64_t maxY);
+    // Re-encodes every line to make room for the one given
+    void reencode(const Line& incoming);
+    void writeCoordinates(std::size_t idx, const Line& line);
+    bool m_wide { false };
+    int m_originX { 0 };
+    int m_originY { 0 };
+    std::vector<std::array<std::uint16_t, 4>> m_narrow; // x0, y0, x1, y1 less the origin
+    std::vector<std::array<std::int32_t, 4>> m_wideCoordinates; // only used when m_wide
+    std::vector<std::uint8_t> m_flags;
+    std::vector<Colour> m_colours;
+};
+
+} // namespace mgo
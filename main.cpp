@@ -1,10 +1,16 @@
+#include "commands.h"
 #include "configreader.h"
 #include "level.h"
+#include "profiler.h"
+#include "utils.h"
 
 #include <SFML/Graphics.hpp>
+#include <chrono>
 #include <cmath>
+#include <ctime>
 #include <filesystem>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
 
 int main(int argc, char* argv[])
@@ -12,9 +18,11 @@ int main(int argc, char* argv[])
     std::string loadFileName;
     try {
 
+        if (mgo::isCommand(argc, argv)) {
+            return mgo::runCommand(argc, argv);
+        }
         if (argc != 2) {
-            std::cout << "Usage: level_designer <filename>\n\n";
-            std::cout << "If the file doesn't exist it will be created on save\n\n";
+            mgo::printUsage();
             return 1;
         }
 
@@ -34,19 +42,50 @@ int main(int argc, char* argv[])
             argv[1],
             sf::Style::Titlebar | sf::Style::Close,
             fullscreen ? sf::State::Fullscreen : sf::State::Windowed);
-        window.setFramerateLimit(24);
+        // Frames are only drawn when something has changed, so this just stops panning and
+        // dragging from redrawing faster than the display can show
+        window.setVerticalSyncEnabled(true);
 
         mgo::Level level(window, screenWidth, screenHeight);
 
         level.load(argv[1]);
 
+        // How much CPU we use while waiting for input, which should be close to nothing
+        std::chrono::steady_clock::duration idleTime {};
+        std::clock_t idleCpuTime = 0;
+
         while (window.isOpen()) {
-            for (;;) {
-                const auto event = window.pollEvent();
+            std::optional<sf::Event> event;
+            level.pollBackgroundSave();
+            if (!level.needsRedraw()) {
+                // Nothing to draw, so sleep until something happens, waking now and then to
+                // check on a save in the background
+                const auto idleStart = std::chrono::steady_clock::now();
+                const auto idleCpuStart = std::clock();
+                event = level.isSaving() ? window.waitEvent(sf::milliseconds(100))
+                                         : window.waitEvent();
+                idleTime += std::chrono::steady_clock::now() - idleStart;
+                idleCpuTime += std::clock() - idleCpuStart;
+            }
+            PROFILE_BEGIN_FRAME();
+            {
+                PROFILE_PHASE(EVENTS);
                 if (!event.has_value()) {
-                    break;
+                    event = window.pollEvent();
+                }
+                for (; event.has_value(); event = window.pollEvent()) {
+                    const auto* key = event->getIf<sf::Event::KeyPressed>();
+                    if (key && key->scancode == sf::Keyboard::Scancode::F3) {
+                        // Frame profiling overlay (not available in release builds)
+                        PROFILE_TOGGLE_HUD();
+                        level.requestRedraw();
+                        continue;
+                    }
+                    level.processEvent(window, *event);
                 }
-                level.processEvent(window, *event);
+            }
+            if (!level.needsRedraw() || !window.isOpen()) {
+                continue;
             }
 
             level.clampViewport();
@@ -63,10 +102,26 @@ int main(int argc, char* argv[])
             window.setView(level.getFixedView());
             level.drawModes(window);
             level.drawDialog(window);
+            PROFILE_END_FRAME();
+            PROFILE_DRAW_HUD(window, level.getFont());
             // Set view back otherwise mouse coords appear to be
             // reported in the wrong position
             window.setView(level.getView());
             window.display();
+            level.clearNeedsRedraw();
+        }
+        // The window may have been closed with a save still going, which has to finish, and
+        // whose failure has to be reported, before exiting
+        if (!level.waitForBackgroundSave()) {
+            return 1;
+        }
+        const double idleSeconds = std::chrono::duration<double>(idleTime).count();
+        if (idleSeconds > 0.0) {
+            const double idleCpuSeconds = static_cast<double>(idleCpuTime) / CLOCKS_PER_SEC;
+            std::cout << "Idle for " << mgo::utils::to_string_with_precision(idleSeconds, 1)
+                      << "s using " << mgo::utils::to_string_with_precision(
+                             100.0 * idleCpuSeconds / idleSeconds, 2)
+                      << "% CPU\n";
         }
         return 0;
     } catch (const std::exception& e) {
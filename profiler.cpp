@@ -0,0 +1,139 @@
+#include "profiler.h"
+
+#ifdef LEVEL_DESIGNER_PROFILING
+
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<std::size_t> g_allocations { 0 };
+
+constexpr std::array<const char*, static_cast<std::size_t>(mgo::ProfilePhase::COUNT)> phaseNames {
+    "events", "grid", "draw", "objects", "modes"
+};
+
+} // namespace
+
+// Replacing the global allocation functions is the only way to see every allocation,
+// including those made inside SFML and the standard library. The array and nothrow forms
+// forward to these by default.
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace mgo {
+
+std::size_t allocationCount()
+{
+    return g_allocations.load(std::memory_order_relaxed);
+}
+
+FrameProfiler& FrameProfiler::instance()
+{
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+void FrameProfiler::beginFrame()
+{
+    m_frameStart = Clock::now();
+    m_currentPhaseMs = {};
+    m_drawCalls = 0;
+    m_vertices = 0;
+    m_frameAllocationsStart = allocationCount();
+}
+
+void FrameProfiler::endFrame()
+{
+    // The frame time is the work done for the frame. Time spent waiting for events or for
+    // the display is excluded, as the editor only redraws when something has changed.
+    auto& stats = m_history[m_historyNext];
+    stats.frameMs = std::chrono::duration<double, std::milli>(Clock::now() - m_frameStart).count();
+    stats.phaseMs = m_currentPhaseMs;
+    m_historyNext = (m_historyNext + 1) % historySize;
+    m_historyCount = std::min(m_historyCount + 1, historySize);
+    m_lastDrawCalls = m_drawCalls;
+    m_lastVertices = m_vertices;
+    m_lastAllocations = allocationCount() - m_frameAllocationsStart;
+}
+
+void FrameProfiler::addPhaseTime(ProfilePhase phase, Clock::duration time)
+{
+    m_currentPhaseMs[static_cast<std::size_t>(phase)]
+        += std::chrono::duration<double, std::milli>(time).count();
+}
+
+void FrameProfiler::countDrawCall(std::size_t vertices)
+{
+    ++m_drawCalls;
+    m_vertices += vertices;
+}
+
+void FrameProfiler::drawHud(sf::RenderTarget& target, const sf::Font& font) const
+{
+    if (!m_hudVisible || m_historyCount == 0) {
+        return;
+    }
+    std::vector<double> frameTimes;
+    frameTimes.reserve(m_historyCount);
+    std::array<double, phaseCount> phaseTotals {};
+    for (std::size_t i = 0; i < m_historyCount; ++i) {
+        frameTimes.push_back(m_history[i].frameMs);
+        for (std::size_t p = 0; p < phaseCount; ++p) {
+            phaseTotals[p] += m_history[i].phaseMs[p];
+        }
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    auto percentile = [&](double p) {
+        return frameTimes[static_cast<std::size_t>(p * static_cast<double>(frameTimes.size() - 1))];
+    };
+    std::string text = "frame p50 " + utils::to_string_with_precision(percentile(0.5), 1)
+        + "ms  p99 " + utils::to_string_with_precision(percentile(0.99), 1) + "ms  ("
+        + std::to_string(m_historyCount) + " frames)\n";
+    for (std::size_t p = 0; p < phaseCount; ++p) {
+        text += std::string(phaseNames[p]) + " "
+            + utils::to_string_with_precision(phaseTotals[p] / static_cast<double>(m_historyCount), 2)
+            + "ms  ";
+    }
+    text += "\ndraw calls " + std::to_string(m_lastDrawCalls) + "  vertices "
+        + std::to_string(m_lastVertices) + "  allocations " + std::to_string(m_lastAllocations);
+
+    sf::Text hud(font);
+    hud.setFillColor(sf::Color::Yellow);
+    hud.setCharacterSize(12);
+    hud.setPosition({ 5.f, 25.f });
+    hud.setString(text);
+    sf::RectangleShape background;
+    const auto bounds = hud.getGlobalBounds();
+    background.setPosition({ bounds.position.x - 3.f, bounds.position.y - 3.f });
+    background.setSize({ bounds.size.x + 6.f, bounds.size.y + 6.f });
+    background.setFillColor(sf::Color(0, 0, 0, 180));
+    target.draw(background);
+    target.draw(hud);
+}
+
+} // namespace mgo
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+// Frame profiling, shown as an overlay in the editor (toggled with F3). Everything here is
+// compiled out when NDEBUG is defined, i.e. in release builds, so should only be used
+// through the PROFILE_ macros below.
+
+#ifndef NDEBUG
+#define LEVEL_DESIGNER_PROFILING
+#endif
+
+#ifdef LEVEL_DESIGNER_PROFILING
+
+#include <SFML/Graphics.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+namespace mgo {
+
+enum class ProfilePhase {
+    EVENTS,
+    GRID_LINES,
+    DRAW,
+    OBJECTS,
+    MODES,
+    COUNT
+};
+
+class FrameProfiler {
+public:
+    static FrameProfiler& instance();
+    void beginFrame();
+    // Call once everything to be measured has been drawn, but before the HUD itself
+    void endFrame();
+    void addPhaseTime(ProfilePhase phase, std::chrono::steady_clock::duration time);
+    void countDrawCall(std::size_t vertices);
+    void toggleHud() { m_hudVisible = !m_hudVisible; }
+    void drawHud(sf::RenderTarget& target, const sf::Font& font) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    // Frames kept for the rolling statistics
+    static constexpr std::size_t historySize = 240;
+    static constexpr std::size_t phaseCount = static_cast<std::size_t>(ProfilePhase::COUNT);
+    struct FrameStats {
+        double frameMs { 0.0 };
+        std::array<double, phaseCount> phaseMs {};
+    };
+    bool m_hudVisible { false };
+    std::array<FrameStats, historySize> m_history {};
+    std::size_t m_historyCount { 0 };
+    std::size_t m_historyNext { 0 };
+    std::array<double, phaseCount> m_currentPhaseMs {};
+    Clock::time_point m_frameStart {};
+    std::size_t m_frameAllocationsStart { 0 };
+    std::size_t m_drawCalls { 0 };
+    std::size_t m_vertices { 0 };
+    // Counts for the last completed frame, as the current one is still in progress
+    std::size_t m_lastDrawCalls { 0 };
+    std::size_t m_lastVertices { 0 };
+    std::size_t m_lastAllocations { 0 };
+};
+
+// Times the enclosing scope
+class ScopedPhase {
+public:
+    explicit ScopedPhase(ProfilePhase phase)
+        : m_phase(phase)
+        , m_start(std::chrono::steady_clock::now())
+    {
+    }
+    ~ScopedPhase()
+    {
+        FrameProfiler::instance().addPhaseTime(m_phase, std::chrono::steady_clock::now() - m_start);
+    }
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    ProfilePhase m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Total number of heap allocations made by the program so far
+std::size_t allocationCount();
+
+} // namespace mgo
+
+#define PROFILE_PHASE(phase) mgo::ScopedPhase profilePhase_(mgo::ProfilePhase::phase)
+#define PROFILE_DRAW_CALL(vertices) mgo::FrameProfiler::instance().countDrawCall(vertices)
+#define PROFILE_BEGIN_FRAME() mgo::FrameProfiler::instance().beginFrame()
+#define PROFILE_END_FRAME() mgo::FrameProfiler::instance().endFrame()
+#define PROFILE_TOGGLE_HUD() mgo::FrameProfiler::instance().toggleHud()
+#define PROFILE_DRAW_HUD(target, font) mgo::FrameProfiler::instance().drawHud(target, font)
+
+#else
+
+#define PROFILE_PHASE(phase) ((void)0)
+#define PROFILE_DRAW_CALL(vertices) ((void)0)
+#define PROFILE_BEGIN_FRAME() ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#define PROFILE_TOGGLE_HUD() ((void)0)
+#define PROFILE_DRAW_HUD(target, font) ((void)0)
+
+#endif
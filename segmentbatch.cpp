@@ -0,0 +1,463 @@
+#include "segmentbatch.h"
+#include "level.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+
+// The SIMD kernels are compiled for their instruction sets individually, so the rest of
+// the program still runs on processors without them
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SEGMENT_BATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct Columns {
+    const std::int32_t* x0;
+    const std::int32_t* y0;
+    const std::int32_t* x1;
+    const std::int32_t* y1;
+    std::size_t count;
+};
+
+// The shape's vertices, with an edge from each to the next and from the last to the first
+struct Shape {
+    const std::pair<int, int>* vertices;
+    std::size_t count;
+};
+
+using FirstCrossingKernel = std::size_t (*)(const Columns& c, const Shape& shape);
+using ClosestPointsKernel = void (*)(
+    const Columns& c, int x, int y, int d, int* outX, int* outY, std::uint8_t* within);
+
+struct Kernels {
+    const char* name;
+    FirstCrossingKernel firstCrossing;
+    ClosestPointsKernel closestPoints;
+};
+
+// The scalar kernels also finish off whatever is left over after the SIMD ones' last block
+std::size_t firstCrossingFrom(std::size_t first, const Columns& c, const Shape& shape)
+{
+    for (std::size_t i = first; i < c.count; ++i) {
+        for (std::size_t v = 0; v < shape.count; ++v) {
+            const auto [qx0, qy0] = shape.vertices[v];
+            const auto [qx1, qy1] = shape.vertices[(v + 1) % shape.count];
+            if (mgo::utils::doLinesIntersect(
+                    qx0, qy0, qx1, qy1, c.x0[i], c.y0[i], c.x1[i], c.y1[i])) {
+                return i;
+            }
+        }
+    }
+    return c.count;
+}
+
+void closestPointsFrom(
+    std::size_t first,
+    const Columns& c,
+    int x,
+    int y,
+    int d,
+    int* outX,
+    int* outY,
+    std::uint8_t* within)
+{
+    for (std::size_t i = first; i < c.count; ++i) {
+        const auto nearest
+            = mgo::utils::closestPointOnLine(c.x0[i], c.y0[i], c.x1[i], c.y1[i], x, y, d);
+        outX[i] = nearest.has_value() ? nearest->first : 0;
+        outY[i] = nearest.has_value() ? nearest->second : 0;
+        within[i] = nearest.has_value();
+    }
+}
+
+std::size_t firstCrossingScalar(const Columns& c, const Shape& shape)
+{
+    return firstCrossingFrom(0, c, shape);
+}
+
+void closestPointsScalar(
+    const Columns& c, int x, int y, int d, int* outX, int* outY, std::uint8_t* within)
+{
+    closestPointsFrom(0, c, x, y, d, outX, outY, within);
+}
+
+#ifdef SEGMENT_BATCH_X86
+
+// These follow doLinesIntersect without its branches: a segment misses an edge if it's
+// wholly to one side of the edge's bounding box, or if either of the parametric numerators
+// is outside the range between zero and the denominator. The products are of differences
+// which fit in 32 bits while the coordinates are within SegmentBatch's SIMD range, so the
+// 32x32->64 bit multiplies are exact. Each block of segments
+// is tested against every edge of the shape before moving on to the next.
+
+// All ones in the lanes whose segment x3,y3-x4,y4 misses the query edge
+__attribute__((target("avx2"))) __m256i missesAvx2(
+    __m256i x3,
+    __m256i y3,
+    __m256i x4,
+    __m256i y4,
+    __m256i bx,
+    __m256i by,
+    const std::pair<int, int>& from,
+    const std::pair<int, int>& to)
+{
+    const auto [qx0, qy0] = from;
+    const auto [qx1, qy1] = to;
+    const __m256i ax = _mm256_set1_epi64x(static_cast<long long>(qx1) - qx0);
+    const __m256i ay = _mm256_set1_epi64x(static_cast<long long>(qy1) - qy0);
+    const __m256i xLo = _mm256_set1_epi64x(std::min(qx0, qx1));
+    const __m256i xHi = _mm256_set1_epi64x(std::max(qx0, qx1));
+    const __m256i yLo = _mm256_set1_epi64x(std::min(qy0, qy1));
+    const __m256i yHi = _mm256_set1_epi64x(std::max(qy0, qy1));
+    __m256i reject = _mm256_or_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi64(x3, xHi), _mm256_cmpgt_epi64(x4, xHi)),
+        _mm256_and_si256(_mm256_cmpgt_epi64(xLo, x3), _mm256_cmpgt_epi64(xLo, x4)));
+    reject = _mm256_or_si256(
+        reject, _mm256_and_si256(_mm256_cmpgt_epi64(y3, yHi), _mm256_cmpgt_epi64(y4, yHi)));
+    reject = _mm256_or_si256(
+        reject, _mm256_and_si256(_mm256_cmpgt_epi64(yLo, y3), _mm256_cmpgt_epi64(yLo, y4)));
+
+    const __m256i cx = _mm256_sub_epi64(_mm256_set1_epi64x(qx0), x3);
+    const __m256i cy = _mm256_sub_epi64(_mm256_set1_epi64x(qy0), y3);
+    const __m256i d = _mm256_sub_epi64(_mm256_mul_epi32(by, cx), _mm256_mul_epi32(bx, cy));
+    const __m256i f = _mm256_sub_epi64(_mm256_mul_epi32(ay, bx), _mm256_mul_epi32(ax, by));
+    const __m256i e = _mm256_sub_epi64(_mm256_mul_epi32(ax, cy), _mm256_mul_epi32(ay, cx));
+    // The numerators must lie between min(0, f) and max(0, f)
+    const __m256i fPositive = _mm256_cmpgt_epi64(f, _mm256_setzero_si256());
+    const __m256i lo = _mm256_andnot_si256(fPositive, f);
+    const __m256i hi = _mm256_and_si256(fPositive, f);
+    reject = _mm256_or_si256(
+        reject, _mm256_or_si256(_mm256_cmpgt_epi64(lo, d), _mm256_cmpgt_epi64(d, hi)));
+    return _mm256_or_si256(
+        reject, _mm256_or_si256(_mm256_cmpgt_epi64(lo, e), _mm256_cmpgt_epi64(e, hi)));
+}
+
+__attribute__((target("avx2"))) std::size_t firstCrossingAvx2(const Columns& c, const Shape& shape)
+{
+    std::size_t i = 0;
+    for (; i + 4 <= c.count; i += 4) {
+        const __m256i x3
+            = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.x0 + i)));
+        const __m256i y3
+            = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.y0 + i)));
+        const __m256i x4
+            = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.x1 + i)));
+        const __m256i y4
+            = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.y1 + i)));
+        const __m256i bx = _mm256_sub_epi64(x3, x4);
+        const __m256i by = _mm256_sub_epi64(y3, y4);
+        __m256i missesAll = _mm256_set1_epi64x(-1);
+        for (std::size_t v = 0; v < shape.count; ++v) {
+            missesAll = _mm256_and_si256(
+                missesAll,
+                missesAvx2(
+                    x3,
+                    y3,
+                    x4,
+                    y4,
+                    bx,
+                    by,
+                    shape.vertices[v],
+                    shape.vertices[(v + 1) % shape.count]));
+        }
+        const int crossed = ~_mm256_movemask_pd(_mm256_castsi256_pd(missesAll)) & 0xf;
+        if (crossed != 0) {
+            return i + static_cast<std::size_t>(__builtin_ctz(crossed));
+        }
+    }
+    return firstCrossingFrom(i, c, shape);
+}
+
+__attribute__((target("sse4.2"))) __m128i missesSse42(
+    __m128i x3,
+    __m128i y3,
+    __m128i x4,
+    __m128i y4,
+    __m128i bx,
+    __m128i by,
+    const std::pair<int, int>& from,
+    const std::pair<int, int>& to)
+{
+    const auto [qx0, qy0] = from;
+    const auto [qx1, qy1] = to;
+    const __m128i ax = _mm_set1_epi64x(static_cast<long long>(qx1) - qx0);
+    const __m128i ay = _mm_set1_epi64x(static_cast<long long>(qy1) - qy0);
+    const __m128i xLo = _mm_set1_epi64x(std::min(qx0, qx1));
+    const __m128i xHi = _mm_set1_epi64x(std::max(qx0, qx1));
+    const __m128i yLo = _mm_set1_epi64x(std::min(qy0, qy1));
+    const __m128i yHi = _mm_set1_epi64x(std::max(qy0, qy1));
+    __m128i reject = _mm_or_si128(
+        _mm_and_si128(_mm_cmpgt_epi64(x3, xHi), _mm_cmpgt_epi64(x4, xHi)),
+        _mm_and_si128(_mm_cmpgt_epi64(xLo, x3), _mm_cmpgt_epi64(xLo, x4)));
+    reject = _mm_or_si128(
+        reject, _mm_and_si128(_mm_cmpgt_epi64(y3, yHi), _mm_cmpgt_epi64(y4, yHi)));
+    reject = _mm_or_si128(
+        reject, _mm_and_si128(_mm_cmpgt_epi64(yLo, y3), _mm_cmpgt_epi64(yLo, y4)));
+
+    const __m128i cx = _mm_sub_epi64(_mm_set1_epi64x(qx0), x3);
+    const __m128i cy = _mm_sub_epi64(_mm_set1_epi64x(qy0), y3);
+    const __m128i d = _mm_sub_epi64(_mm_mul_epi32(by, cx), _mm_mul_epi32(bx, cy));
+    const __m128i f = _mm_sub_epi64(_mm_mul_epi32(ay, bx), _mm_mul_epi32(ax, by));
+    const __m128i e = _mm_sub_epi64(_mm_mul_epi32(ax, cy), _mm_mul_epi32(ay, cx));
+    const __m128i fPositive = _mm_cmpgt_epi64(f, _mm_setzero_si128());
+    const __m128i lo = _mm_andnot_si128(fPositive, f);
+    const __m128i hi = _mm_and_si128(fPositive, f);
+    reject = _mm_or_si128(reject, _mm_or_si128(_mm_cmpgt_epi64(lo, d), _mm_cmpgt_epi64(d, hi)));
+    return _mm_or_si128(reject, _mm_or_si128(_mm_cmpgt_epi64(lo, e), _mm_cmpgt_epi64(e, hi)));
+}
+
+__attribute__((target("sse4.2"))) std::size_t
+firstCrossingSse42(const Columns& c, const Shape& shape)
+{
+    std::size_t i = 0;
+    for (; i + 2 <= c.count; i += 2) {
+        const __m128i x3
+            = _mm_cvtepi32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.x0 + i)));
+        const __m128i y3
+            = _mm_cvtepi32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.y0 + i)));
+        const __m128i x4
+            = _mm_cvtepi32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.x1 + i)));
+        const __m128i y4
+            = _mm_cvtepi32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.y1 + i)));
+        const __m128i bx = _mm_sub_epi64(x3, x4);
+        const __m128i by = _mm_sub_epi64(y3, y4);
+        __m128i missesAll = _mm_set1_epi64x(-1);
+        for (std::size_t v = 0; v < shape.count; ++v) {
+            missesAll = _mm_and_si128(
+                missesAll,
+                missesSse42(
+                    x3,
+                    y3,
+                    x4,
+                    y4,
+                    bx,
+                    by,
+                    shape.vertices[v],
+                    shape.vertices[(v + 1) % shape.count]));
+        }
+        const int crossed = ~_mm_movemask_pd(_mm_castsi128_pd(missesAll)) & 0x3;
+        if (crossed != 0) {
+            return i + static_cast<std::size_t>(__builtin_ctz(crossed));
+        }
+    }
+    return firstCrossingFrom(i, c, shape);
+}
+
+// These repeat closestPointOnLine's arithmetic operation for operation, so the doubles
+// round identically. Zero-length segments divide by zero, and their lanes are replaced by
+// the segment's start before the result is converted.
+
+__attribute__((target("avx2"))) void closestPointsAvx2(
+    const Columns& c, int x, int y, int d, int* outX, int* outY, std::uint8_t* within)
+{
+    const __m256d px = _mm256_set1_pd(x);
+    const __m256d py = _mm256_set1_pd(y);
+    const __m256i qx = _mm256_set1_epi64x(x);
+    const __m256i qy = _mm256_set1_epi64x(y);
+    const __m256i maxSquared = _mm256_set1_epi64x(static_cast<long long>(d) * d);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    std::size_t i = 0;
+    for (; i + 4 <= c.count; i += 4) {
+        const __m256d x0
+            = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.x0 + i)));
+        const __m256d y0
+            = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.y0 + i)));
+        const __m256d x1
+            = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.x1 + i)));
+        const __m256d y1
+            = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c.y1 + i)));
+        const __m256d dx = _mm256_sub_pd(x1, x0);
+        const __m256d dy = _mm256_sub_pd(y1, y0);
+        const __m256d ppx = _mm256_sub_pd(px, x0);
+        const __m256d ppy = _mm256_sub_pd(py, y0);
+        __m256d t = _mm256_div_pd(
+            _mm256_add_pd(_mm256_mul_pd(ppx, dx), _mm256_mul_pd(ppy, dy)),
+            _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+        t = _mm256_max_pd(_mm256_min_pd(t, one), zero);
+        const __m256d zeroLength = _mm256_and_pd(
+            _mm256_cmp_pd(dx, zero, _CMP_EQ_OQ), _mm256_cmp_pd(dy, zero, _CMP_EQ_OQ));
+        const __m256d nx
+            = _mm256_blendv_pd(_mm256_add_pd(x0, _mm256_mul_pd(t, dx)), x0, zeroLength);
+        const __m256d ny
+            = _mm256_blendv_pd(_mm256_add_pd(y0, _mm256_mul_pd(t, dy)), y0, zeroLength);
+        const __m128i nxi = _mm256_cvttpd_epi32(nx);
+        const __m128i nyi = _mm256_cvttpd_epi32(ny);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outX + i), nxi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outY + i), nyi);
+
+        const __m256i ddx = _mm256_sub_epi64(qx, _mm256_cvtepi32_epi64(nxi));
+        const __m256i ddy = _mm256_sub_epi64(qy, _mm256_cvtepi32_epi64(nyi));
+        const __m256i squared
+            = _mm256_add_epi64(_mm256_mul_epi32(ddx, ddx), _mm256_mul_epi32(ddy, ddy));
+        const int far
+            = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(squared, maxSquared)));
+        for (int k = 0; k < 4; ++k) {
+            within[i + k] = (far & (1 << k)) == 0;
+        }
+    }
+    closestPointsFrom(i, c, x, y, d, outX, outY, within);
+}
+
+__attribute__((target("sse4.2"))) void closestPointsSse42(
+    const Columns& c, int x, int y, int d, int* outX, int* outY, std::uint8_t* within)
+{
+    const __m128d px = _mm_set1_pd(x);
+    const __m128d py = _mm_set1_pd(y);
+    const __m128i qx = _mm_set1_epi64x(x);
+    const __m128i qy = _mm_set1_epi64x(y);
+    const __m128i maxSquared = _mm_set1_epi64x(static_cast<long long>(d) * d);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    std::size_t i = 0;
+    for (; i + 2 <= c.count; i += 2) {
+        const __m128d x0
+            = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.x0 + i)));
+        const __m128d y0
+            = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.y0 + i)));
+        const __m128d x1
+            = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.x1 + i)));
+        const __m128d y1
+            = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(c.y1 + i)));
+        const __m128d dx = _mm_sub_pd(x1, x0);
+        const __m128d dy = _mm_sub_pd(y1, y0);
+        const __m128d ppx = _mm_sub_pd(px, x0);
+        const __m128d ppy = _mm_sub_pd(py, y0);
+        __m128d t = _mm_div_pd(
+            _mm_add_pd(_mm_mul_pd(ppx, dx), _mm_mul_pd(ppy, dy)),
+            _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+        t = _mm_max_pd(_mm_min_pd(t, one), zero);
+        const __m128d zeroLength = _mm_and_pd(_mm_cmpeq_pd(dx, zero), _mm_cmpeq_pd(dy, zero));
+        const __m128d nx = _mm_blendv_pd(_mm_add_pd(x0, _mm_mul_pd(t, dx)), x0, zeroLength);
+        const __m128d ny = _mm_blendv_pd(_mm_add_pd(y0, _mm_mul_pd(t, dy)), y0, zeroLength);
+        const __m128i nxi = _mm_cvttpd_epi32(nx);
+        const __m128i nyi = _mm_cvttpd_epi32(ny);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(outX + i), nxi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(outY + i), nyi);
+
+        const __m128i ddx = _mm_sub_epi64(qx, _mm_cvtepi32_epi64(nxi));
+        const __m128i ddy = _mm_sub_epi64(qy, _mm_cvtepi32_epi64(nyi));
+        const __m128i squared = _mm_add_epi64(_mm_mul_epi32(ddx, ddx), _mm_mul_epi32(ddy, ddy));
+        const int far = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(squared, maxSquared)));
+        for (int k = 0; k < 2; ++k) {
+            within[i + k] = (far & (1 << k)) == 0;
+        }
+    }
+    closestPointsFrom(i, c, x, y, d, outX, outY, within);
+}
+
+#endif
+
+const Kernels scalarKernels { "scalar", firstCrossingScalar, closestPointsScalar };
+
+// The named kernels, if the processor has the instructions they need
+std::optional<Kernels> availableKernels(std::string_view name)
+{
+    if (name == scalarKernels.name) {
+        return scalarKernels;
+    }
+#ifdef SEGMENT_BATCH_X86
+    __builtin_cpu_init();
+    if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+        return Kernels { "avx2", firstCrossingAvx2, closestPointsAvx2 };
+    }
+    if (name == "sse4.2" && __builtin_cpu_supports("sse4.2")) {
+        return Kernels { "sse4.2", firstCrossingSse42, closestPointsSse42 };
+    }
+#endif
+    return std::nullopt;
+}
+
+Kernels chooseKernels()
+{
+    for (const std::string_view name : { "avx2", "sse4.2" }) {
+        if (const auto k = availableKernels(name)) {
+            return *k;
+        }
+    }
+    return scalarKernels;
+}
+
+Kernels& kernels()
+{
+    static Kernels k = chooseKernels();
+    return k;
+}
+
+bool inSimdRange(int v)
+{
+    return v >= mgo::SegmentBatch::minSimdCoordinate
+        && v <= mgo::SegmentBatch::maxSimdCoordinate;
+}
+
+} // namespace
+
+namespace mgo {
+
+void SegmentBatch::clear()
+{
+    m_x0.clear();
+    m_y0.clear();
+    m_x1.clear();
+    m_y1.clear();
+    m_simdExact = true;
+}
+
+void SegmentBatch::push_back(const Line& line)
+{
+    m_x0.push_back(line.x0);
+    m_y0.push_back(line.y0);
+    m_x1.push_back(line.x1);
+    m_y1.push_back(line.y1);
+    m_simdExact = m_simdExact && inSimdRange(line.x0) && inSimdRange(line.y0)
+        && inSimdRange(line.x1) && inSimdRange(line.y1);
+}
+
+std::optional<std::size_t>
+SegmentBatch::firstCrossing(const std::vector<std::pair<int, int>>& shape) const
+{
+    if (shape.size() < 2) {
+        return std::nullopt;
+    }
+    const Columns c { m_x0.data(), m_y0.data(), m_x1.data(), m_y1.data(), size() };
+    const bool exact = m_simdExact && std::all_of(shape.begin(), shape.end(), [](const auto& v) {
+        return inSimdRange(v.first) && inSimdRange(v.second);
+    });
+    const std::size_t found = (exact ? kernels() : scalarKernels)
+                                  .firstCrossing(c, { shape.data(), shape.size() });
+    if (found == size()) {
+        return std::nullopt;
+    }
+    return found;
+}
+
+void SegmentBatch::closestPoints(int x, int y, int d, NearestPoints& out) const
+{
+    out.x.resize(size());
+    out.y.resize(size());
+    out.within.resize(size());
+    const Columns c { m_x0.data(), m_y0.data(), m_x1.data(), m_y1.data(), size() };
+    const bool exact = m_simdExact && inSimdRange(x) && inSimdRange(y);
+    (exact ? kernels() : scalarKernels)
+        .closestPoints(c, x, y, d, out.x.data(), out.y.data(), out.within.data());
+}
+
+const char* SegmentBatch::kernelName()
+{
+    return kernels().name;
+}
+
+bool SegmentBatch::useKernels(std::string_view name)
+{
+    const auto k = availableKernels(name);
+    if (k.has_value()) {
+        kernels() = *k;
+    }
+    return k.has_value();
+}
+
+} // namespace mgo
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mgo {
+
+struct Line;
+
+// Nearest points found by SegmentBatch::closestPoints, one per segment in the batch
+struct NearestPoints {
+    std::vector<int> x;
+    std::vector<int> y;
+    std::vector<std::uint8_t> within; // whether the point is within the distance asked for
+};
+
+// A set of segments held as coordinate columns, so that one query can be tested against all
+// of them at once using SSE or AVX2 where the processor has it (chosen at run time), or
+// one at a time otherwise. Results are the same as those of utils::doLinesIntersect and
+// utils::closestPointOnLine. The SIMD kernels multiply 32-bit differences of coordinates,
+// so they're only used while every coordinate involved is in [minSimdCoordinate,
+// maxSimdCoordinate]; a batch or query reaching beyond that is done one at a time.
+class SegmentBatch {
+public:
+    static constexpr int minSimdCoordinate = -(1 << 30);
+    static constexpr int maxSimdCoordinate = (1 << 30) - 1;
+
+    void clear();
+    void push_back(const Line& line);
+    std::size_t size() const { return m_x0.size(); }
+    // The first segment touched by an edge of the closed polygon with these vertices
+    std::optional<std::size_t> firstCrossing(const std::vector<std::pair<int, int>>& shape) const;
+    // The point on each segment nearest to x,y, and whether it's within d
+    void closestPoints(int x, int y, int d, NearestPoints& out) const;
+    // The kernels in use: "avx2", "sse4.2" or "scalar"
+    static const char* kernelName();
+    // Switches every batch to the named kernels, for checking each of them against the
+    // scalar functions. Returns false, changing nothing, if the processor lacks them. Not
+    // to be called while batches are in use on other threads.
+    static bool useKernels(std::string_view name);
+
+private:
+    bool m_simdExact { true }; // every coordinate is within the SIMD kernels' range
+    std::vector<std::int32_t> m_x0;
+    std::vector<std::int32_t> m_y0;
+    std::vector<std::int32_t> m_x1;
+    std::vector<std::int32_t> m_y1;
+};
+
+} // namespace mgo
@@ -0,0 +1,50 @@
+#include "selection.h"
+
+#include <algorithm>
+
+namespace mgo {
+
+bool LineSelection::insert(std::size_t idx)
+{
+    if (contains(idx)) {
+        return false;
+    }
+    if (idx >= m_positions.size()) {
+        m_positions.resize(idx + 1, notSelected);
+    }
+    m_positions[idx] = static_cast<std::uint32_t>(m_indices.size());
+    m_indices.push_back(idx);
+    return true;
+}
+
+bool LineSelection::erase(std::size_t idx)
+{
+    if (!contains(idx)) {
+        return false;
+    }
+    // The last member takes the place of the one removed
+    const std::uint32_t position = m_positions[idx];
+    const std::size_t last = m_indices.back();
+    m_indices[position] = last;
+    m_positions[last] = position;
+    m_indices.pop_back();
+    m_positions[idx] = notSelected;
+    return true;
+}
+
+void LineSelection::clear()
+{
+    for (const std::size_t idx : m_indices) {
+        m_positions[idx] = notSelected;
+    }
+    m_indices.clear();
+}
+
+std::vector<std::size_t> LineSelection::sorted() const
+{
+    std::vector<std::size_t> result { m_indices };
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+} // namespace mgo
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace mgo {
+
+// The indices of the selected lines, with a slot per line recording where each one is in the
+// list of members, so that testing, adding and removing a line all take constant time however
+// large the selection. Clearing only visits what was selected.
+class LineSelection {
+public:
+    bool contains(std::size_t idx) const
+    {
+        return idx < m_positions.size() && m_positions[idx] != notSelected;
+    }
+    bool empty() const { return m_indices.empty(); }
+    std::size_t size() const { return m_indices.size(); }
+    // Returns false if the line was already selected
+    bool insert(std::size_t idx);
+    // Returns false if the line wasn't selected
+    bool erase(std::size_t idx);
+    void clear();
+    // In no particular order
+    const std::vector<std::size_t>& indices() const { return m_indices; }
+    // In ascending order, as recorded in actions
+    std::vector<std::size_t> sorted() const;
+    template <typename Pred> void eraseIf(Pred&& pred)
+    {
+        for (std::size_t i = m_indices.size(); i > 0; --i) {
+            if (pred(m_indices[i - 1])) {
+                erase(m_indices[i - 1]);
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint32_t notSelected = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::size_t> m_indices;
+    std::vector<std::uint32_t> m_positions; // into m_indices, by line index
+};
+
+} // namespace mgo
@@ -0,0 +1,232 @@
+#include "simplify.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+using mgo::Line;
+
+// Squared distance from p to the segment a-b
+float distanceSquared(sf::Vector2f p, sf::Vector2f a, sf::Vector2f b)
+{
+    const sf::Vector2f ab = b - a;
+    const float lengthSquared = ab.x * ab.x + ab.y * ab.y;
+    float t = 0.f;
+    if (lengthSquared > 0.f) {
+        const sf::Vector2f ap = p - a;
+        t = std::clamp((ap.x * ab.x + ap.y * ab.y) / lengthSquared, 0.f, 1.f);
+    }
+    const sf::Vector2f d = p - (a + ab * t);
+    return d.x * d.x + d.y * d.y;
+}
+
+bool isZeroLength(const Line& l)
+{
+    return l.x0 == l.x1 && l.y0 == l.y1;
+}
+
+std::uint64_t vertexKey(int x, int y)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32)
+        | static_cast<std::uint32_t>(y);
+}
+
+bool canMerge(const Line& a, const Line& b)
+{
+    return !a.breakable && !b.breakable && a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+} // namespace
+
+namespace mgo {
+
+namespace {
+
+// A closed chain starts and ends at the same point, which would leave Douglas-Peucker
+// measuring from a chord of zero length. So it's split at the point furthest from the start
+// and the halves simplified separately, always keeping at least a triangle so that a loop
+// can't collapse into a spike or a point.
+std::vector<std::size_t> simplifyLoop(const std::vector<sf::Vector2f>& points, float tolerance)
+{
+    std::size_t split = 1;
+    float furthestDistance = 0.f;
+    for (std::size_t i = 1; i + 1 < points.size(); ++i) {
+        const float d = distanceSquared(points[i], points.front(), points.front());
+        if (d > furthestDistance) {
+            furthestDistance = d;
+            split = i;
+        }
+    }
+    std::vector<std::size_t> kept = simplifyPolyline(
+        std::vector<sf::Vector2f>(points.begin(), points.begin() + split + 1), tolerance);
+    const auto secondHalf = simplifyPolyline(
+        std::vector<sf::Vector2f>(points.begin() + split, points.end()), tolerance);
+    for (std::size_t i = 1; i < secondHalf.size(); ++i) {
+        kept.push_back(split + secondHalf[i]);
+    }
+    if (kept.size() < 4) {
+        // Down to a line there and back, so keep the point furthest from it as well
+        std::optional<std::size_t> apex;
+        furthestDistance = -1.f;
+        for (std::size_t i = 1; i + 1 < points.size(); ++i) {
+            const float d = distanceSquared(points[i], points.front(), points[split]);
+            if (i != split && d > furthestDistance) {
+                furthestDistance = d;
+                apex = i;
+            }
+        }
+        if (apex.has_value()) {
+            kept.insert(std::lower_bound(kept.begin(), kept.end(), *apex), *apex);
+        }
+    }
+    return kept;
+}
+
+} // namespace
+
+std::vector<std::size_t> simplifyPolyline(const std::vector<sf::Vector2f>& points, float tolerance)
+{
+    if (points.size() <= 2) {
+        std::vector<std::size_t> all(points.size());
+        for (std::size_t i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        return all;
+    }
+    // Iterative rather than recursive as chains can be many thousands of points long
+    std::vector<char> keep(points.size(), 0);
+    keep.front() = 1;
+    keep.back() = 1;
+    const float toleranceSquared = tolerance * tolerance;
+    std::vector<std::pair<std::size_t, std::size_t>> pending { { 0, points.size() - 1 } };
+    while (!pending.empty()) {
+        const auto [first, last] = pending.back();
+        pending.pop_back();
+        float furthestDistance = 0.f;
+        std::size_t furthest = first;
+        for (std::size_t i = first + 1; i < last; ++i) {
+            const float d = distanceSquared(points[i], points[first], points[last]);
+            if (d > furthestDistance) {
+                furthestDistance = d;
+                furthest = i;
+            }
+        }
+        if (furthestDistance > toleranceSquared) {
+            keep[furthest] = 1;
+            pending.emplace_back(first, furthest);
+            pending.emplace_back(furthest, last);
+        }
+    }
+    std::vector<std::size_t> kept;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        if (keep[i]) {
+            kept.push_back(i);
+        }
+    }
+    return kept;
+}
+
+Simplification planSimplification(const std::vector<Line>& lines, float tolerance)
+{
+    Simplification result;
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> linesAt;
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        const Line& l = lines[i];
+        if (l.inactive) {
+            continue;
+        }
+        if (isZeroLength(l)) {
+            result.removed.push_back(i);
+            ++result.zeroLength;
+            continue;
+        }
+        linesAt[vertexKey(l.x0, l.y0)].push_back(i);
+        linesAt[vertexKey(l.x1, l.y1)].push_back(i);
+    }
+
+    // As in LineLod, chains only continue through vertices where exactly two lines meet
+    std::vector<char> visited(lines.size(), 0);
+    std::vector<std::size_t> chain;
+    std::vector<std::pair<int, int>> vertices;
+    auto walk = [&](std::size_t first, int x, int y) {
+        std::size_t current = first;
+        for (;;) {
+            auto it = linesAt.find(vertexKey(x, y));
+            if (it == linesAt.end() || it->second.size() != 2) {
+                return;
+            }
+            const std::size_t next = it->second[0] == current ? it->second[1] : it->second[0];
+            if (visited[next] || !canMerge(lines[next], lines[first])) {
+                return;
+            }
+            visited[next] = 1;
+            chain.push_back(next);
+            const Line& l = lines[next];
+            std::tie(x, y) = (l.x0 == x && l.y0 == y) ? std::pair { l.x1, l.y1 }
+                                                      : std::pair { l.x0, l.y0 };
+            vertices.emplace_back(x, y);
+            current = next;
+        }
+    };
+
+    std::vector<sf::Vector2f> points;
+    for (std::size_t first = 0; first < lines.size(); ++first) {
+        const Line& l = lines[first];
+        if (visited[first] || l.inactive || l.breakable || isZeroLength(l)) {
+            continue;
+        }
+        visited[first] = 1;
+        chain.assign({ first });
+        vertices.clear();
+        walk(first, l.x0, l.y0);
+        std::reverse(vertices.begin(), vertices.end());
+        vertices.emplace_back(l.x0, l.y0);
+        vertices.emplace_back(l.x1, l.y1);
+        walk(first, l.x1, l.y1);
+        if (chain.size() < 2) {
+            continue;
+        }
+        points.clear();
+        for (const auto& [x, y] : vertices) {
+            points.emplace_back(static_cast<float>(x), static_cast<float>(y));
+        }
+        const auto kept = vertices.front() == vertices.back()
+            ? simplifyLoop(points, tolerance)
+            : simplifyPolyline(points, tolerance);
+        if (kept.size() - 1 == chain.size()) {
+            continue;
+        }
+        result.removed.insert(result.removed.end(), chain.begin(), chain.end());
+        for (std::size_t i = 1; i < kept.size(); ++i) {
+            Line merged = l;
+            std::tie(merged.x0, merged.y0) = vertices[kept[i - 1]];
+            std::tie(merged.x1, merged.y1) = vertices[kept[i]];
+            result.added.push_back(merged);
+        }
+    }
+    std::sort(result.removed.begin(), result.removed.end());
+    return result;
+}
+
+std::size_t simplifyLines(std::vector<Line>& lines, float tolerance)
+{
+    Simplification s = planSimplification(lines, tolerance);
+    std::size_t kept = 0;
+    std::size_t next = 0; // into s.removed
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        if (next < s.removed.size() && s.removed[next] == i) {
+            ++next;
+        } else {
+            lines[kept++] = lines[i];
+        }
+    }
+    lines.resize(kept);
+    lines.insert(lines.end(), s.added.begin(), s.added.end());
+    return s.removed.size() - s.added.size();
+}
+
+} // namespace mgo
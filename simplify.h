@@ -0,0 +1,32 @@
+#pragma once
+
+#include "level.h"
+
+#include <SFML/Graphics.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace mgo {
+
+// Douglas-Peucker: returns the indices of the points to keep so that no point removed is
+// further than tolerance from the simplified polyline. The first and last are always kept.
+std::vector<std::size_t> simplifyPolyline(const std::vector<sf::Vector2f>& points, float tolerance);
+
+// How to reduce a set of lines to fewer, equivalent ones
+struct Simplification {
+    std::vector<std::size_t> removed; // indices into the lines given, in ascending order
+    std::vector<Line> added; // replacements for runs of lines which were merged
+    std::size_t zeroLength { 0 }; // how many of those removed were zero length
+};
+
+// Zero-length lines are dropped, and each chain of lines (of the same colour, joined end to
+// end without branching) is replaced by as few lines as keep within tolerance of it. A
+// tolerance of zero only merges exactly collinear runs, and a closed loop always keeps at
+// least three lines. Junctions are never moved, and breakable lines are left as they are
+// since each one breaks separately in the game. Inactive lines are ignored.
+Simplification planSimplification(const std::vector<Line>& lines, float tolerance);
+
+// Applies planSimplification, returning the number of lines removed overall
+std::size_t simplifyLines(std::vector<Line>& lines, float tolerance);
+
+} // namespace mgo
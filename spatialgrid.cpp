@@ -0,0 +1,185 @@
+#include "spatialgrid.h"
+#include "level.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mgo {
+
+SpatialGrid::SpatialGrid(float cellSize)
+    : m_cellSize(cellSize)
+{
+}
+
+void SpatialGrid::insert(std::size_t id, const Line& line)
+{
+    forEachCell(line, [&](std::uint64_t k) { addCell(k, id); });
+    if (id >= m_stamps.size()) {
+        m_stamps.resize(id + 1, 0);
+    }
+}
+
+void SpatialGrid::insertBounds(std::size_t id, float minX, float minY, float maxX, float maxY)
+{
+    constexpr double maxCells = 4096;
+    const double columns = std::floor(maxX / m_cellSize) - std::floor(minX / m_cellSize) + 1;
+    const double rows = std::floor(maxY / m_cellSize) - std::floor(minY / m_cellSize) + 1;
+    if (columns * rows > maxCells) {
+        m_oversized.push_back(id);
+    } else {
+        for (std::int32_t cy = cellCoord(minY); cy <= cellCoord(maxY); ++cy) {
+            for (std::int32_t cx = cellCoord(minX); cx <= cellCoord(maxX); ++cx) {
+                addCell(key(cx, cy), id);
+            }
+        }
+    }
+    if (id >= m_stamps.size()) {
+        m_stamps.resize(id + 1, 0);
+    }
+}
+
+void SpatialGrid::remove(std::size_t id, const Line& line)
+{
+    forEachCell(line, [&](std::uint64_t k) {
+        auto it = m_cells.find(k);
+        if (it == m_cells.end()) {
+            return;
+        }
+        auto& ids = it->second;
+        auto found = std::find(ids.begin(), ids.end(), id);
+        if (found != ids.end()) {
+            *found = ids.back();
+            ids.pop_back();
+        }
+        if (ids.empty()) {
+            m_cells.erase(it);
+        }
+    });
+}
+
+void SpatialGrid::clear()
+{
+    m_cells.clear();
+    m_oversized.clear();
+    m_minCellX = INT32_MAX;
+    m_minCellY = INT32_MAX;
+    m_maxCellX = INT32_MIN;
+    m_maxCellY = INT32_MIN;
+    m_stamps.clear();
+    m_currentStamp = 0;
+}
+
+void SpatialGrid::query(
+    float minX,
+    float minY,
+    float maxX,
+    float maxY,
+    std::vector<std::size_t>& results) const
+{
+    results.clear();
+    if (m_cells.empty() && m_oversized.empty()) {
+        return;
+    }
+    if (++m_currentStamp == 0) {
+        // Wrapped around, so old stamps could give false positives
+        std::fill(m_stamps.begin(), m_stamps.end(), 0);
+        m_currentStamp = 1;
+    }
+    // Only cells which have ever been populated can hold anything
+    const std::int32_t cx0 = std::max(cellCoord(minX), m_minCellX);
+    const std::int32_t cx1 = std::min(cellCoord(maxX), m_maxCellX);
+    const std::int32_t cy0 = std::max(cellCoord(minY), m_minCellY);
+    const std::int32_t cy1 = std::min(cellCoord(maxY), m_maxCellY);
+    if (cx0 <= cx1 && cy0 <= cy1) {
+        const double cellCount
+            = (static_cast<double>(cx1) - cx0 + 1) * (static_cast<double>(cy1) - cy0 + 1);
+        if (cellCount > static_cast<double>(m_cells.size())) {
+            // Fewer populated cells than cells in the rectangle, so check each of those instead
+            for (const auto& [k, ids] : m_cells) {
+                const auto cx = static_cast<std::int32_t>(static_cast<std::uint32_t>(k >> 32));
+                const auto cy = static_cast<std::int32_t>(static_cast<std::uint32_t>(k));
+                if (cx >= cx0 && cx <= cx1 && cy >= cy0 && cy <= cy1) {
+                    addIds(ids, results);
+                }
+            }
+        } else {
+            for (std::int32_t cy = cy0; cy <= cy1; ++cy) {
+                for (std::int32_t cx = cx0; cx <= cx1; ++cx) {
+                    auto it = m_cells.find(key(cx, cy));
+                    if (it != m_cells.end()) {
+                        addIds(it->second, results);
+                    }
+                }
+            }
+        }
+    }
+    addIds(m_oversized, results);
+    std::sort(results.begin(), results.end());
+}
+
+void SpatialGrid::addCell(std::uint64_t k, std::size_t id)
+{
+    m_cells[k].push_back(id);
+    const auto cx = static_cast<std::int32_t>(static_cast<std::uint32_t>(k >> 32));
+    const auto cy = static_cast<std::int32_t>(static_cast<std::uint32_t>(k));
+    m_minCellX = std::min(m_minCellX, cx);
+    m_minCellY = std::min(m_minCellY, cy);
+    m_maxCellX = std::max(m_maxCellX, cx);
+    m_maxCellY = std::max(m_maxCellY, cy);
+}
+
+void SpatialGrid::addIds(
+    const std::vector<std::size_t>& ids,
+    std::vector<std::size_t>& results) const
+{
+    for (const std::size_t id : ids) {
+        if (m_stamps[id] != m_currentStamp) {
+            m_stamps[id] = m_currentStamp;
+            results.push_back(id);
+        }
+    }
+}
+
+template <typename Fn> void SpatialGrid::forEachCell(const Line& line, Fn&& fn) const
+{
+    // Walk each row of cells the segment passes through, working out which columns the
+    // part of the segment within that row covers. This avoids registering the segment in
+    // every cell of its bounding box, which matters for long diagonal lines.
+    const double x0 = line.x0;
+    const double y0 = line.y0;
+    const double x1 = line.x1;
+    const double y1 = line.y1;
+    const std::int32_t cy0 = cellCoord(std::min(y0, y1));
+    const std::int32_t cy1 = cellCoord(std::max(y0, y1));
+    for (std::int32_t cy = cy0; cy <= cy1; ++cy) {
+        double segMinX = std::min(x0, x1);
+        double segMaxX = std::max(x0, x1);
+        if (y0 != y1) {
+            const double rowTop = std::max(static_cast<double>(cy) * m_cellSize, std::min(y0, y1));
+            const double rowBottom
+                = std::min(static_cast<double>(cy + 1) * m_cellSize, std::max(y0, y1));
+            const double xAtTop = x0 + (x1 - x0) * (rowTop - y0) / (y1 - y0);
+            const double xAtBottom = x0 + (x1 - x0) * (rowBottom - y0) / (y1 - y0);
+            segMinX = std::min(xAtTop, xAtBottom);
+            segMaxX = std::max(xAtTop, xAtBottom);
+        }
+        const std::int32_t cx0 = cellCoord(segMinX);
+        const std::int32_t cx1 = cellCoord(segMaxX);
+        for (std::int32_t cx = cx0; cx <= cx1; ++cx) {
+            fn(key(cx, cy));
+        }
+    }
+}
+
+std::int32_t SpatialGrid::cellCoord(double v) const
+{
+    return static_cast<std::int32_t>(std::floor(v / m_cellSize));
+}
+
+std::uint64_t SpatialGrid::key(std::int32_t cellX, std::int32_t cellY)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cellX)) << 32)
+        | static_cast<std::uint32_t>(cellY);
+}
+
+} // namespace mgo
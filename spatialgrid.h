@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace mgo {
+
+struct Line;
+
+// Buckets line segments into square cells so that a lookup around a point only has to
+// consider the segments passing through nearby cells, rather than every line in the level.
+// Cells are held sparsely so only populated areas of the map cost any memory.
+class SpatialGrid {
+public:
+    explicit SpatialGrid(float cellSize = 50.f);
+    void insert(std::size_t id, const Line& line);
+    // Registers an item in every cell overlapping the rectangle, for things which are looked
+    // up by their area rather than by their outline. Items covering a very large area are
+    // kept aside and returned by every query instead.
+    void insertBounds(std::size_t id, float minX, float minY, float maxX, float maxY);
+    void remove(std::size_t id, const Line& line);
+    void clear();
+    // Fills results with the ids of all segments passing through cells which overlap the
+    // given rectangle. Each id appears once, in ascending order. Note this is a broad-phase
+    // test only, callers still need to check the candidates' actual geometry. The cost is
+    // bounded by the number of populated cells, however large the rectangle.
+    void query(
+        float minX,
+        float minY,
+        float maxX,
+        float maxY,
+        std::vector<std::size_t>& results) const;
+
+private:
+    template <typename Fn> void forEachCell(const Line& line, Fn&& fn) const;
+    std::int32_t cellCoord(double v) const;
+    static std::uint64_t key(std::int32_t cellX, std::int32_t cellY);
+    void addCell(std::uint64_t k, std::size_t id);
+    // Adds those of ids not already in results during the current query
+    void addIds(const std::vector<std::size_t>& ids, std::vector<std::size_t>& results) const;
+    float m_cellSize;
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> m_cells;
+    std::vector<std::size_t> m_oversized;
+    // Covers every cell populated since the last clear(), to limit the cells a query visits
+    std::int32_t m_minCellX { INT32_MAX };
+    std::int32_t m_minCellY { INT32_MAX };
+    std::int32_t m_maxCellX { INT32_MIN };
+    std::int32_t m_maxCellY { INT32_MIN };
+    // Used to de-duplicate ids of segments which span several cells during a query
+    mutable std::vector<std::uint32_t> m_stamps;
+    mutable std::uint32_t m_currentStamp { 0 };
+};
+
+} // namespace mgo
@@ -0,0 +1,143 @@
+#include "tilecache.h"
+#include "profiler.h"
+
+#include <cmath>
+
+namespace mgo {
+
+TileCache::TileCache(unsigned tileSize, std::size_t maxTiles)
+    : m_tileSize(tileSize)
+    , m_maxTiles(maxTiles)
+{
+}
+
+void TileCache::invalidate(const sf::FloatRect& area)
+{
+    if (m_tiles.empty()) {
+        return;
+    }
+    // Lines are rasterised up to a pixel either side of where they are
+    const sf::Vector2f pad(2.f / m_scale.x, 2.f / m_scale.y);
+    const sf::Vector2f min = area.position - pad;
+    const sf::Vector2f max = area.position + area.size + pad;
+    for (auto& [k, tile] : m_tiles) {
+        const sf::FloatRect t = tileArea(k);
+        if (t.position.x <= max.x && min.x <= t.position.x + t.size.x && t.position.y <= max.y
+            && min.y <= t.position.y + t.size.y) {
+            tile.dirty = true;
+        }
+    }
+}
+
+void TileCache::invalidateAll()
+{
+    for (auto& [k, tile] : m_tiles) {
+        m_spareTextures.push_back(std::move(tile.texture));
+    }
+    m_tiles.clear();
+}
+
+void TileCache::draw(sf::RenderTarget& target, const RenderFn& render)
+{
+    const sf::View& view = target.getView();
+    const sf::FloatRect visible(view.getCenter() - view.getSize() / 2.f, view.getSize());
+    if (m_unavailable) {
+        render(target, visible);
+        return;
+    }
+    const sf::Vector2f scale(
+        static_cast<float>(target.getSize().x) / view.getSize().x,
+        static_cast<float>(target.getSize().y) / view.getSize().y);
+    if (scale != m_scale) {
+        // While zooming, each frame is at a new scale, so tiles filled now would most likely
+        // be thrown away on the next one. Until the scale has stayed put for a frame, it's
+        // cheaper to draw what's in view directly.
+        invalidateAll();
+        m_scale = scale;
+        m_tileWorldSize = { m_tileSize / scale.x, m_tileSize / scale.y };
+        render(target, visible);
+        return;
+    }
+    ++m_frame;
+    const auto first = sf::Vector2i(
+        static_cast<int>(std::floor(visible.position.x / m_tileWorldSize.x)),
+        static_cast<int>(std::floor(visible.position.y / m_tileWorldSize.y)));
+    const auto last = sf::Vector2i(
+        static_cast<int>(std::floor((visible.position.x + visible.size.x) / m_tileWorldSize.x)),
+        static_cast<int>(std::floor((visible.position.y + visible.size.y) / m_tileWorldSize.y)));
+    for (int ty = first.y; ty <= last.y; ++ty) {
+        for (int tx = first.x; tx <= last.x; ++tx) {
+            const std::uint64_t k = key(tx, ty);
+            Tile& tile = m_tiles[k];
+            if (!tile.texture) {
+                tile.texture = takeTexture();
+                if (!tile.texture) {
+                    m_tiles.erase(k);
+                    invalidateAll();
+                    m_unavailable = true;
+                    render(target, visible);
+                    return;
+                }
+            }
+            const sf::FloatRect area = tileArea(k);
+            if (tile.dirty) {
+                sf::RenderTexture& texture = *tile.texture;
+                texture.setView(sf::View(area));
+                texture.clear(sf::Color::Transparent);
+                render(texture, area);
+                texture.display();
+                tile.dirty = false;
+            }
+            tile.lastDrawn = m_frame;
+            sf::Sprite sprite(tile.texture->getTexture());
+            sprite.setPosition(area.position);
+            sprite.setScale({ 1.f / m_scale.x, 1.f / m_scale.y });
+            target.draw(sprite);
+            PROFILE_DRAW_CALL(4);
+        }
+    }
+}
+
+std::uint64_t TileCache::key(std::int32_t tileX, std::int32_t tileY)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(tileX)) << 32)
+        | static_cast<std::uint32_t>(tileY);
+}
+
+sf::FloatRect TileCache::tileArea(std::uint64_t key) const
+{
+    const auto tileX = static_cast<std::int32_t>(static_cast<std::uint32_t>(key >> 32));
+    const auto tileY = static_cast<std::int32_t>(static_cast<std::uint32_t>(key));
+    return { { tileX * m_tileWorldSize.x, tileY * m_tileWorldSize.y }, m_tileWorldSize };
+}
+
+std::unique_ptr<sf::RenderTexture> TileCache::takeTexture()
+{
+    if (!m_spareTextures.empty()) {
+        auto texture = std::move(m_spareTextures.back());
+        m_spareTextures.pop_back();
+        return texture;
+    }
+    if (m_tiles.size() > m_maxTiles) {
+        // Reuse the texture of the tile which has been out of view for longest, if any is
+        auto oldest = m_tiles.end();
+        for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+            if (it->second.texture && it->second.lastDrawn != m_frame
+                && (oldest == m_tiles.end() || it->second.lastDrawn < oldest->second.lastDrawn)) {
+                oldest = it;
+            }
+        }
+        if (oldest != m_tiles.end()) {
+            auto texture = std::move(oldest->second.texture);
+            m_tiles.erase(oldest);
+            return texture;
+        }
+    }
+    auto texture = std::make_unique<sf::RenderTexture>();
+    if (!texture->resize({ m_tileSize, m_tileSize })) {
+        return nullptr;
+    }
+    return texture;
+}
+
+} // namespace mgo
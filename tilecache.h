@@ -0,0 +1,48 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace mgo {
+
+// Keeps what's drawn of the world in textures a tile at a time, at the scale of the view,
+// so that drawing an unchanged view again (e.g. while panning) only draws the tiles in it.
+// A tile is only rendered again once something in it has been invalidated, and all of them
+// when the scale changes. A frame at a new scale is drawn directly, without tiles, so that
+// zooming doesn't fill tiles only to discard them on the next step. Textures of tiles out of
+// view for longest are reused for new ones.
+class TileCache {
+public:
+    // Draws everything within the area into the target, whose view is set to the area
+    using RenderFn = std::function<void(sf::RenderTarget& target, const sf::FloatRect& area)>;
+
+    explicit TileCache(unsigned tileSize = 512, std::size_t maxTiles = 64);
+    void invalidate(const sf::FloatRect& area);
+    void invalidateAll();
+    // Draws the part of the world in the target's view, rendering any tiles which need it
+    void draw(sf::RenderTarget& target, const RenderFn& render);
+
+private:
+    struct Tile {
+        std::unique_ptr<sf::RenderTexture> texture;
+        bool dirty { true };
+        std::uint64_t lastDrawn { 0 }; // frame
+    };
+    static std::uint64_t key(std::int32_t tileX, std::int32_t tileY);
+    sf::FloatRect tileArea(std::uint64_t key) const;
+    std::unique_ptr<sf::RenderTexture> takeTexture();
+    unsigned m_tileSize; // in pixels
+    std::size_t m_maxTiles;
+    sf::Vector2f m_scale; // pixels per world unit the tiles are rendered at
+    sf::Vector2f m_tileWorldSize;
+    std::unordered_map<std::uint64_t, Tile> m_tiles;
+    std::vector<std::unique_ptr<sf::RenderTexture>> m_spareTextures;
+    std::uint64_t m_frame { 0 };
+    bool m_unavailable { false }; // render textures couldn't be created, so draw directly
+};
+
+} // namespace mgo
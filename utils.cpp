@@ -2,14 +2,18 @@
 #include "level.h"
 
 #include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <cstdio>
+#include <system_error>
 
 namespace {
 
-unsigned squaredDistance(unsigned x1, unsigned y1, unsigned x2, unsigned y2)
+long long squaredDistance(int x1, int y1, int x2, int y2)
 {
-    return (x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1);
+    const long long dx = static_cast<long long>(x2) - x1;
+    const long long dy = static_cast<long long>(y2) - y1;
+    return dx * dx + dy * dy;
 }
 
 std::tuple<double, double>
@@ -27,28 +31,36 @@ calculatePolarParams(double centreX, double centreY, double startX, double start
 namespace mgo {
 namespace utils {
 
-bool doLinesIntersect(long x1, long y1, long x2, long y2, long x3, long y3, long x4, long y4)
+bool doLinesIntersect(
+    long long x1,
+    long long y1,
+    long long x2,
+    long long y2,
+    long long x3,
+    long long y3,
+    long long x4,
+    long long y4)
 {
 
-    long Ax, Bx, Cx, Ay, By, Cy, d, e, f;
-    short x1lo, x1hi, y1lo, y1hi;
+    long long Ax, Bx, Cx, Ay, By, Cy, d, e, f;
+    long long x1lo, x1hi, y1lo, y1hi;
 
     Ax = x2 - x1;
     Bx = x3 - x4;
 
     if (Ax < 0) {
-        x1lo = (short)x2;
-        x1hi = (short)x1;
+        x1lo = x2;
+        x1hi = x1;
     } else {
-        x1hi = (short)x2;
-        x1lo = (short)x1;
+        x1hi = x2;
+        x1lo = x1;
     }
     if (Bx > 0) {
-        if (x1hi < (short)x4 || (short)x3 < x1lo) {
+        if (x1hi < x4 || x3 < x1lo) {
             return false;
         }
     } else {
-        if (x1hi < (short)x3 || (short)x4 < x1lo) {
+        if (x1hi < x3 || x4 < x1lo) {
             return false;
         }
     }
@@ -57,18 +69,18 @@ bool doLinesIntersect(long x1, long y1, long x2, long y2, long x3, long y3, long
     By = y3 - y4;
 
     if (Ay < 0) {
-        y1lo = (short)y2;
-        y1hi = (short)y1;
+        y1lo = y2;
+        y1hi = y1;
     } else {
-        y1hi = (short)y2;
-        y1lo = (short)y1;
+        y1hi = y2;
+        y1lo = y1;
     }
     if (By > 0) {
-        if (y1hi < (short)y4 || (short)y3 < y1lo) {
+        if (y1hi < y4 || y3 < y1lo) {
             return false;
         }
     } else {
-        if (y1hi < (short)y3 || (short)y4 < y1lo) {
+        if (y1hi < y3 || y4 < y1lo) {
             return false;
         }
     }
@@ -104,37 +116,32 @@ bool doLinesIntersect(long x1, long y1, long x2, long y2, long x3, long y3, long
     return true;
 }
 
-std::optional<std::pair<unsigned, unsigned>> closestPointOnLine(
-    unsigned x0,
-    unsigned y0,
-    unsigned x1,
-    unsigned y1,
-    unsigned x,
-    unsigned y,
-    unsigned d)
+std::optional<std::pair<int, int>>
+closestPointOnLine(int x0, int y0, int x1, int y1, int x, int y, int d)
 {
-    const int dx = x1 - x0;
-    const int dy = y1 - y0;
-
-    if (dx == 0 && dy == 0) {
-        if (squaredDistance(x, y, x0, y0) <= d * d) {
+    if (x0 == x1 && y0 == y1) {
+        if (squaredDistance(x, y, x0, y0) <= static_cast<long long>(d) * d) {
             return { { x0, y0 } };
         } else {
             return std::nullopt;
         }
     }
 
-    int px = x - x0;
-    int py = y - y0;
+    // Doubles hold the differences exactly whatever the coordinates. SegmentBatch repeats
+    // these steps in the same order, so keep the two in step.
+    const double dx = static_cast<double>(x1) - x0;
+    const double dy = static_cast<double>(y1) - y0;
+    const double px = static_cast<double>(x) - x0;
+    const double py = static_cast<double>(y) - y0;
 
-    double t = (px * dx + py * dy) / (double)(dx * dx + dy * dy);
+    double t = (px * dx + py * dy) / (dx * dx + dy * dy);
     t = std::max(0.0, std::min(1.0, t)); // Clamping t to the range [0, 1]
 
-    const unsigned nearestX = x0 + t * dx;
-    const unsigned nearestY = y0 + t * dy;
+    const int nearestX = static_cast<int>(x0 + t * dx);
+    const int nearestY = static_cast<int>(y0 + t * dy);
 
     // Check if this nearest point is within the allowed distance `d`
-    if (squaredDistance(x, y, nearestX, nearestY) <= d * d) {
+    if (squaredDistance(x, y, nearestX, nearestY) <= static_cast<long long>(d) * d) {
         return { { nearestX, nearestY } };
     } else {
         return std::nullopt;
@@ -180,5 +187,16 @@ std::vector<Line> getRegularPolygon(
     return vec;
 }
 
+std::optional<float> parseFloat(std::string_view text)
+{
+    float value;
+    const char* last = text.data() + text.size();
+    const auto [ptr, ec] = std::from_chars(text.data(), last, value);
+    if (ec != std::errc() || ptr != last || !std::isfinite(value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
 } // namespace utils
 } // namespace mgo
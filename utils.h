@@ -2,6 +2,7 @@
 
 #include <optional>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
 namespace mgo {
@@ -18,16 +19,23 @@ template <typename T> std::string to_string_with_precision(const T a_value, cons
     return std::move(out).str();
 }
 
-bool doLinesIntersect(long x1, long y1, long x2, long y2, long x3, long y3, long x4, long y4);
-
-std::optional<std::pair<unsigned, unsigned>> closestPointOnLine(
-    unsigned x1,
-    unsigned y1,
-    unsigned x2,
-    unsigned y2,
-    unsigned x,
-    unsigned y,
-    unsigned d);
+// Whether the segment x1,y1-x2,y2 touches x3,y3-x4,y4 (collinear overlaps count). Exact for
+// coordinates within +/-2^30.
+bool doLinesIntersect(
+    long long x1,
+    long long y1,
+    long long x2,
+    long long y2,
+    long long x3,
+    long long y3,
+    long long x4,
+    long long y4);
+
+std::optional<std::pair<int, int>>
+closestPointOnLine(int x1, int y1, int x2, int y2, int x, int y, int d);
+
+// The whole of the text as a finite number, or none if it isn't one (e.g. "-", "." or "nan")
+std::optional<float> parseFloat(std::string_view text);
 
 std::vector<Line> getRegularPolygon(
     double startX,